@@ -0,0 +1,83 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include "atsp_model.hpp"
+
+/// @brief Don't look bits: the queues of the cities the neighborhoods
+/// still have to look at.
+///
+/// Each neighborhood has its own queue and only looks at the moves
+/// around the cities in it. A city whose moves do not improve the
+/// tour leaves the queue (its bit is off), until an arc into or out
+/// of it, or out of one of its neighbors, changes: a move of any
+/// neighborhood or a perturbation activates the city again in all
+/// the queues. Once a local search has converged most of the cities
+/// are inactive and the next one only looks at the few that are not.
+class atsp_active_queues
+{
+public:
+  atsp_active_queues(int cities, int queues)
+    : cities_m(cities), bits_m(cities*queues, 0), queues_m(queues)
+  { }
+
+  /// @brief Activates a city in all the queues.
+  void activate(int city)
+  {
+    for(unsigned int qq(0); qq != queues_m.size(); ++qq)
+      if(!bits_m[qq*cities_m+city])
+	{
+	  bits_m[qq*cities_m+city] = 1;
+	  queues_m[qq].push_back(city);
+	}
+  }
+
+  /// @brief Activates the cities at pos-1, pos and pos+1 of the
+  /// tour (the depot out of the permutation).
+  void activate_around(const atsp_model& model, int pos)
+  {
+    for(int ii(pos-1); ii != pos+2; ++ii)
+      activate(ii < 0 || ii >= model.depot() ? model.depot()
+	       : model.city(ii));
+  }
+
+  /// @brief Activates all the cities, in order.
+  void activate_all()
+  {
+    for(int ii(0); ii != cities_m; ++ii)
+      activate(ii);
+  }
+
+  /// @brief Activates the cities around the positions whose city
+  /// differs between the permutation pi and the one of model (e.g.
+  /// after atsp_model::perturbate()): those are the cities whose arcs
+  /// have changed.
+  void activate_changes(const std::vector<int>& pi, const atsp_model& model)
+  {
+    for(int ii(0); ii != model.depot(); ++ii)
+      if(pi[ii] != model.city(ii))
+	activate_around(model, ii);
+  }
+
+  /// @brief The first active city of a queue, false if there are none.
+  bool front(int queue, int& city) const
+  {
+    if(queues_m[queue].empty())
+      return false;
+    city = queues_m[queue].front();
+    return true;
+  }
+
+  /// @brief Deactivates the first city of a queue.
+  void pop(int queue)
+  {
+    bits_m[queue*cities_m+queues_m[queue].front()] = 0;
+    queues_m[queue].pop_front();
+  }
+
+private:
+  int cities_m;
+  std::vector<char> bits_m;
+  std::vector< std::deque<int> > queues_m;
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <stdint.h>
+
+#include "atsp_model.hpp"
+
+/// @brief The candidate lists of an instance: the k cheapest outgoing
+/// and incoming arcs of each city, the depot included.
+///
+/// Both lists are kept in flat arrays of n * k cities, the ones of a
+/// city sorted by the cost of their arc (ties by city). A neighborhood
+/// using them only looks at the moves introducing at least one
+/// candidate arc, the few that have a chance to improve the tour, and
+/// a scan of O(n^2) moves becomes O(nk) (O(n^3) becomes O(nk^2)).
+class atsp_candidates
+{
+public:
+  /// @brief Builds the lists of the instance of model, in O(n^2 log k).
+  atsp_candidates(const atsp_model& model, unsigned int k)
+    : k_m(0), outgoing_m(), incoming_m()
+  {
+    const int n = model.depot()+1;
+    k_m = std::min(k, (unsigned int)(n-1));
+    outgoing_m.resize(n*k_m);
+    incoming_m.resize(n*k_m);
+    std::vector< std::pair<int64_t, int> > out(n-1), in(n-1);
+    for(int ii(0); ii != n; ++ii)
+      {
+	for(int jj(0), kk(0); jj != n; ++jj)
+	  if(jj != ii)
+	    {
+	      out[kk] = std::make_pair(model.arc(ii, jj), jj);
+	      in[kk] = std::make_pair(model.arc(jj, ii), jj);
+	      ++kk;
+	    }
+	std::partial_sort(out.begin(), out.begin()+k_m, out.end());
+	std::partial_sort(in.begin(), in.begin()+k_m, in.end());
+	for(unsigned int kk(0); kk != k_m; ++kk)
+	  {
+	    outgoing_m[ii*k_m+kk] = out[kk].second;
+	    incoming_m[ii*k_m+kk] = in[kk].second;
+	  }
+      }
+  }
+
+  /// @brief The number of candidates of each city.
+  unsigned int k() const
+  { return k_m; }
+
+  /// @brief The k cheapest successors of a city.
+  const int* outgoing(int city) const
+  { return &outgoing_m[city*k_m]; }
+
+  /// @brief The k cheapest predecessors of a city.
+  const int* incoming(int city) const
+  { return &incoming_m[city*k_m]; }
+
+  /// @brief The inversions from..to (from < to, see
+  /// atsp_model::invert()) introducing a candidate arc on either end
+  /// of the inverted path, O(nk) of them.
+  void
+  inversions(const atsp_model& model,
+	     std::vector< std::pair<int, int> >& moves) const
+  {
+    const int n = model.depot()+1;
+    moves.clear();
+    for(int a(0); a != n; ++a)
+      for(unsigned int kk(0); kk != k_m; ++kk)
+	add_inversions(model, a, outgoing_m[a*k_m+kk], moves);
+  }
+
+  /// @brief The inversions introducing a candidate arc out of or
+  /// into city, O(k) of them.
+  void
+  inversions(const atsp_model& model, int city,
+	     std::vector< std::pair<int, int> >& moves) const
+  {
+    moves.clear();
+    for(unsigned int kk(0); kk != k_m; ++kk)
+      {
+	add_inversions(model, city, outgoing_m[city*k_m+kk], moves);
+	add_inversions(model, incoming_m[city*k_m+kk], city, moves);
+      }
+  }
+
+private:
+  // The inversions introducing the arc a -> b
+  static void
+  add_inversions(const atsp_model& model, int a, int b,
+		 std::vector< std::pair<int, int> >& moves)
+  {
+    // a -> b before the path, b becomes its first city
+    if(b != model.depot())
+      {
+	const int from = model.position(a)+1;
+	const int to = model.position(b);
+	if(from < to)
+	  moves.push_back(std::make_pair(from, to));
+      }
+    // a -> b after the path, a becomes its last city
+    if(a != model.depot())
+      {
+	const int from = model.position(a);
+	const int to = (b == model.depot() ? model.depot()
+			: model.position(b)) - 1;
+	if(from < to)
+	  moves.push_back(std::make_pair(from, to));
+      }
+  }
+
+  unsigned int k_m;
+  std::vector<int> outgoing_m;
+  std::vector<int> incoming_m;
+};
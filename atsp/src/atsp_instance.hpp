@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <tr1/memory>
+
+/// @brief The arc costs of an ATSP instance, an n x n matrix stored
+/// row-major in a single, cache line aligned, buffer.
+///
+/// Each row is padded up to a multiple of the cache line size, so
+/// that every row starts on a line boundary: the arcs out of a city
+/// are read from as few lines as possible.
+///
+/// Once loaded an instance is never modified and is shared, through
+/// an atsp_instance_ptr, by all the solutions of the same problem:
+/// copying a solution only copies the tour, its cost and its indices,
+/// O(n).
+class atsp_instance
+{
+public:
+  enum { alignment = 64 };
+
+  /// @brief A zero filled n x n instance.
+  explicit atsp_instance(unsigned int n)
+    : n_m(n), stride_m(0), data_m(0)
+  {
+    const unsigned int per_line = alignment / sizeof(int);
+    stride_m = (n + per_line - 1) / per_line * per_line;
+    void* p = 0;
+    if(n && ::posix_memalign(&p, alignment, sizeof(int) * stride_m * n))
+      throw std::bad_alloc();
+    data_m = static_cast<int*>(p);
+    if(n)
+      std::memset(data_m, 0, sizeof(int) * stride_m * n);
+  }
+
+  ~atsp_instance() { ::free(data_m); }
+
+  /// @brief Number of cities, the depot included.
+  unsigned int size() const { return n_m; }
+
+  /// @brief The costs of the arcs out of city i.
+  const int* row(unsigned int i) const { return data_m + i * stride_m; }
+
+  int& operator()(unsigned int i, unsigned int j)
+  { return data_m[i * stride_m + j]; }
+  int operator()(unsigned int i, unsigned int j) const
+  { return data_m[i * stride_m + j]; }
+
+private:
+  atsp_instance(const atsp_instance&);
+  atsp_instance& operator=(const atsp_instance&);
+
+  unsigned int n_m;
+  unsigned int stride_m;
+  int* data_m;
+};
+
+typedef std::tr1::shared_ptr<const atsp_instance> atsp_instance_ptr;
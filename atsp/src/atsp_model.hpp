@@ -1,9 +1,10 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <cassert>
-#include <valarray>
 #include <algorithm>
+#include <stdint.h>
 #if defined (WIN32)
 #  include <random>
 #else
@@ -11,20 +12,47 @@
 #endif
 #include <metslib/mets.h>
 
+#include "atsp_instance.hpp"
+
+/// @brief A solution of the ATSP: the permutation of all the cities
+/// but the last one (the depot), which opens and closes the tour.
+///
+/// The cost of the tour is cached, together with the prefix sums of
+/// the arcs along the permutation walked forwards and backwards and
+/// the position of each city: the cost of any path of consecutive
+/// positions, in either direction, is O(1) (see path()), and so is
+/// the evaluation of a move that cuts the tour in a few paths (see
+/// atsp_runs). Every change of the permutation must go through the
+/// model (invert(), exchange(), random_shuffle(), perturbate()) so
+/// that the cache is kept up to date, the moves of metslib that swap
+/// the elements of the permutation directly can not be used.
+///
+/// The arc costs are kept in an atsp_instance shared by all the
+/// solutions of the problem: copying a solution is O(n).
 class atsp_model : public mets::permutation_problem
 {
 protected:
-  std::valarray< std::valarray<int> > matrix;
-  // int64_t c_m;
+  /// @brief The shared, immutable, arc costs.
+  atsp_instance_ptr instance_m;
+  int64_t c_m;
+  // forward_m[k] is the cost of the path from position 0 to k,
+  // backward_m[k] the cost of the same path walked from k to 0
+  std::vector<int64_t> forward_m;
+  std::vector<int64_t> backward_m;
+  // the position of each city, -1 for the depot
+  std::vector<int> position_m;
   
 public:
-  atsp_model() : permutation_problem(0), matrix() /* c_m(0) */ {};
+  atsp_model() 
+    : permutation_problem(0), instance_m(), c_m(0), forward_m(), 
+      backward_m(), position_m()
+  {};
   
   /// @brief Returns the objective function value. This value is
   /// updated every time the variable is modified.
   mets::gol_type cost_function() const 
   {
-    return (mets::gol_type)cost_calculator();
+    return (mets::gol_type)c_m;
   }
   
   void copy_from(const mets::feasible_solution& sol)
@@ -33,12 +61,11 @@ public:
     if(o)
       {
 	mets::permutation_problem::copy_from(sol);
-	unsigned int n = o->pi_m.size()+1;
-	matrix.resize(n);
-	for(unsigned int ii = 0; ii != n; ++ii)
-	  { matrix[ii].resize(n); }
-	matrix = o->matrix;
-	// c_m = o->c_m;
+	instance_m = o->instance_m;
+	c_m = o->c_m;
+	forward_m = o->forward_m;
+	backward_m = o->backward_m;
+	position_m = o->position_m;
       }
     else
       {
@@ -50,12 +77,79 @@ public:
   void random_shuffle(std::tr1::mt19937& rng)
   {
     mets::random_shuffle(*this, rng);
-    // c_m = cost_calculator();
+    update();
   }
 
   void perturbate(int n, std::tr1::mt19937& rng)
   {
     mets::perturbate(*this, n, rng);
+    update();
+  }
+
+  /// @brief The permutation of the cities but the depot.
+  const std::vector<int>& permutation() const 
+  { return pi_m; }
+
+  /// @brief The city at position pos of the permutation.
+  int city(int pos) const 
+  { return pi_m[pos]; }
+
+  /// @brief The position of a city in the permutation, -1 for the
+  /// depot.
+  int position(int city) const 
+  { return position_m[city]; }
+
+  /// @brief The city opening and closing the tour.
+  int depot() const 
+  { return pi_m.size(); }
+
+  /// @brief The cost of the arc between two cities.
+  int64_t arc(int from, int to) const 
+  { return (*instance_m)(from, to); }
+
+  /// @brief The cost of the path from position first to position
+  /// last, walked backwards when last < first.
+  int64_t path(int first, int last) const
+  {
+    if(first <= last)
+      return forward_m[last] - forward_m[first];
+    return backward_m[first] - backward_m[last];
+  }
+
+  /// @brief Inverts the positions from..to, wrapping around the end
+  /// of the permutation when to < from (as mets::invert_subsequence).
+  void invert(int from, int to)
+  {
+    const int size = pi_m.size();
+    const int top = from < to ? (to-from+1) : (size+to-from+1);
+    for(int ii(0); ii != top/2; ++ii)
+      std::swap(pi_m[(from+ii)%size], pi_m[(size+to-ii)%size]);
+    update();
+  }
+
+  /// @brief Exchanges the adjacent paths first..middle and
+  /// middle+1..last, none of them is inverted.
+  void exchange(int first, int middle, int last)
+  {
+    std::rotate(pi_m.begin()+first, pi_m.begin()+middle+1, 
+		pi_m.begin()+last+1);
+    update();
+  }
+
+  /// @brief The cost of the tour after exchange(first, middle, last),
+  /// from the three arcs it changes.
+  int64_t exchange_cost(int first, int middle, int last) const
+  {
+    const int before = first ? pi_m[first-1] : depot();
+    const int after = last+1 != (int)pi_m.size() ? pi_m[last+1] : depot();
+    const atsp_instance& c = *instance_m;
+    return c_m
+      - c(before, pi_m[first]) 
+      - c(pi_m[middle], pi_m[middle+1]) 
+      - c(pi_m[last], after)
+      + c(before, pi_m[middle+1])
+      + c(pi_m[last], pi_m[first])
+      + c(pi_m[middle], after);
   }
 
   friend std::ostream& operator<<(std::ostream& os, const atsp_model& p);
@@ -63,46 +157,237 @@ public:
   
 protected:
   
+  // Recomputes the cached cost and the prefix sums
+  void update()
+  {
+    const unsigned int size = pi_m.size();
+    forward_m.resize(size);
+    backward_m.resize(size);
+    position_m.resize(size+1);
+    position_m[size] = -1;
+    for(unsigned int ii(0); ii != size; ++ii)
+      position_m[ pi_m[ii] ] = ii;
+    if(!size)
+      {
+	c_m = 0;
+	return;
+      }
+    const atsp_instance& c = *instance_m;
+    forward_m[0] = backward_m[0] = 0;
+    for(unsigned int ii(1); ii != size; ++ii)
+      {
+	forward_m[ii] = forward_m[ii-1] + c( pi_m[ii-1], pi_m[ii] );
+	backward_m[ii] = backward_m[ii-1] + c( pi_m[ii], pi_m[ii-1] );
+      }
+    c_m = c( size, pi_m[0] ) + forward_m[size-1] + c( pi_m[size-1], size );
+  }
+
   // Straight cost calculator
   int64_t cost_calculator() const
   {
+    const atsp_instance& c = *instance_m;
     int64_t sum = 0;
     // opens and closes on pi_m.size()
-    sum += matrix[ pi_m.size() ] [ pi_m[0] ];
+    sum += c( pi_m.size(), pi_m[0] );
     for(unsigned int ii(0); ii != pi_m.size()-1; ++ii)
-      sum += matrix[ pi_m [ ii ] ] [ pi_m [ ii + 1 ] ];
-    sum += matrix[ pi_m[pi_m.size()-1] ] [ pi_m.size() ];
+      sum += c( pi_m [ ii ], pi_m [ ii + 1 ] );
+    sum += c( pi_m[pi_m.size()-1], pi_m.size() );
+    return sum;
+  }
+
+};
+
+/// @brief The tour resulting from a few moves, as runs of consecutive
+/// positions of the current permutation of an atsp_model.
+///
+/// It starts as a single run over the whole permutation. Each
+/// invert() splits at most three runs and cost() only adds up the
+/// arcs joining the runs and the paths inside them, so a compound
+/// move is evaluated in O(1) without touching the permutation.
+class atsp_runs
+{
+public:
+  explicit atsp_runs(int size) : count_m(1)
+  {
+    runs_m[0].first = 0;
+    runs_m[0].last = size-1;
+  }
+
+  /// @brief Inverts the positions from..to of the tour, as
+  /// atsp_model::invert().
+  void invert(int from, int to)
+  {
+    assert(from != to);
+    if(from < to)
+      {
+	const int begin = split(runs_m, count_m, from);
+	const int end = split(runs_m, count_m, to+1);
+	reverse(runs_m+begin, runs_m+end);
+	return;
+      }
+    // the runs of [from, size) followed by those of [0, to], inverted
+    const int a = split(runs_m, count_m, to+1);
+    const int c = split(runs_m, count_m, from);
+    run inverted[capacity];
+    int count = 0;
+    for(int ii(c); ii != count_m; ++ii)
+      inverted[count++] = runs_m[ii];
+    for(int ii(0); ii != a; ++ii)
+      inverted[count++] = runs_m[ii];
+    reverse(inverted, inverted+count);
+    // the first positions of the inversion go back to [from, size)
+    int length = 0;
+    for(int ii(c); ii != count_m; ++ii)
+      length += runs_m[ii].length();
+    const int head = split(inverted, count, length);
+    run result[capacity];
+    int size = 0;
+    for(int ii(head); ii != count; ++ii)
+      result[size++] = inverted[ii];
+    for(int ii(a); ii != c; ++ii)
+      result[size++] = runs_m[ii];
+    for(int ii(0); ii != head; ++ii)
+      result[size++] = inverted[ii];
+    std::copy(result, result+size, runs_m);
+    count_m = size;
+  }
+
+  /// @brief The cost of the tour.
+  int64_t cost(const atsp_model& model) const
+  {
+    int64_t sum = model.arc(model.depot(), model.city(runs_m[0].first));
+    for(int ii(0); ii != count_m; ++ii)
+      {
+	sum += model.path(runs_m[ii].first, runs_m[ii].last);
+	if(ii+1 != count_m)
+	  sum += model.arc(model.city(runs_m[ii].last), 
+			   model.city(runs_m[ii+1].first));
+      }
+    sum += model.arc(model.city(runs_m[count_m-1].last), model.depot());
     return sum;
   }
 
+private:
+  enum { capacity = 8 };
+
+  struct run
+  {
+    int first;
+    int last;
+    int length() const 
+    { return (first <= last ? last-first : first-last) + 1; }
+  };
+
+  // Splits the runs so that one of them starts at the given offset of
+  // the tour and returns its index (count if offset is the length).
+  static int split(run* runs, int& count, int offset)
+  {
+    int ii = 0;
+    for(; ii != count && offset >= runs[ii].length(); ++ii)
+      offset -= runs[ii].length();
+    if(ii == count || offset == 0)
+      return ii;
+    assert(count < capacity);
+    std::copy_backward(runs+ii, runs+count, runs+count+1);
+    ++count;
+    const int step = runs[ii].first <= runs[ii].last ? 1 : -1;
+    runs[ii].last = runs[ii].first + step*(offset-1);
+    runs[ii+1].first = runs[ii].last + step;
+    return ii+1;
+  }
+
+  // Reverses the order of the runs and the direction of each one
+  static void reverse(run* begin, run* end)
+  {
+    std::reverse(begin, end);
+    for(; begin != end; ++begin)
+      std::swap(begin->first, begin->last);
+  }
+
+  run runs_m[capacity];
+  int count_m;
 };
 
+/// @brief The inversion of a subsequence (as
+/// mets::invert_subsequence), evaluated in O(1) on atsp_model.
+class atsp_invert_subsequence : public mets::move
+{
+public:
+  atsp_invert_subsequence(int from, int to) : p1(from), p2(to) { }
+
+  void change(int from, int to)
+  {
+    p1 = from;
+    p2 = to;
+  }
+
+  mets::gol_type evaluate(mets::feasible_solution& s)
+  {
+    atsp_model& model = static_cast<atsp_model&>(s);
+    atsp_runs tour(model.size());
+    tour.invert(p1, p2);
+    return (mets::gol_type)tour.cost(model);
+  }
+
+  void apply(mets::feasible_solution& s)
+  { static_cast<atsp_model&>(s).invert(p1, p2); }
+
+  void unapply(mets::feasible_solution& s)
+  { apply(s); }
+
+protected:
+  int p1;
+  int p2;
+};
 
-/// @brief Generates a the full subsequence inversion neighborhood.
-class three_opt_full_neighborhood : public mets::move_manager
+/// @brief The compound move of three_opt_neighborhood: the inversion
+/// of from..to followed by the swap of the elements at positions at
+/// and at+1, evaluated in O(1) on atsp_model.
+class atsp_three_opt : public mets::move
 {
 public:
-  three_opt_full_neighborhood(int size) : move_manager()
+  atsp_three_opt(int from, int to, int at, int size) 
+    : p1(from), p2(to), p3(at), p4((at+1)%size) 
+  { }
+
+  void change(int from, int to, int at, int size)
   {
-    for(int ii(0); ii!=size; ++ii)
-      for(int jj(0); jj!=size; ++jj)
-	for(int kk(0); kk!=size; ++kk)
-	  if(ii != jj && ii != kk && jj != kk)
-	    {
-	      mets::complex_mana_move* m = new mets::complex_mana_move();
-	      m->push_back(new mets::invert_subsequence(ii,jj));
-	      m->push_back(new mets::invert_subsequence(kk, (kk+1)%size));
-	      moves_m.push_back(m);
-	    }
-  } 
-  
-  /// @brief Dtor.
-  ~three_opt_full_neighborhood() { }
-  
-  /// @brief Selects a different set of moves at each iteration.
-  void refresh(mets::feasible_solution& s) { }
-  
+    p1 = from;
+    p2 = to;
+    p3 = at;
+    p4 = (at+1)%size;
+  }
+
+  mets::gol_type evaluate(mets::feasible_solution& s)
+  {
+    atsp_model& model = static_cast<atsp_model&>(s);
+    atsp_runs tour(model.size());
+    tour.invert(p1, p2);
+    tour.invert(p3, p4);
+    return (mets::gol_type)tour.cost(model);
+  }
+
+  void apply(mets::feasible_solution& s)
+  {
+    atsp_model& model = static_cast<atsp_model&>(s);
+    model.invert(p1, p2);
+    model.invert(p3, p4);
+  }
+
+  void unapply(mets::feasible_solution& s)
+  {
+    atsp_model& model = static_cast<atsp_model&>(s);
+    model.invert(p3, p4);
+    model.invert(p1, p2);
+  }
+
+protected:
+  int p1;
+  int p2;
+  int p3;
+  int p4;
 };
+
 //________________________________________________________________________
 
 // Input/Output functions
@@ -159,15 +444,16 @@ operator>>(std::istream& is, atsp_model& atsp)
     {
       atsp.pi_m.resize(dimension-1);
       std::generate(atsp.pi_m.begin(), atsp.pi_m.end(), mets::sequence(0));
-      atsp.matrix.resize(dimension);
+      atsp_instance* instance = new atsp_instance(dimension);
+      atsp.instance_m.reset(instance);
       for(int ii(0); ii!=dimension; ++ii)
 	{
-	  atsp.matrix[ii].resize(dimension);
 	  for(int jj(0); jj!=dimension; ++jj)
 	    {
-	      is >> atsp.matrix[ii][jj];
+	      is >> (*instance)(ii, jj);
 	    }
 	}
+      atsp.update();
       is >> cmd;
       if(cmd != "EOF")
 	{
@@ -0,0 +1,470 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cassert>
+#include <stdint.h>
+#include <metslib/mets.h>
+
+#include "atsp_model.hpp"
+#include "atsp_candidates.hpp"
+#include "atsp_active.hpp"
+
+/// @brief Exchanges two adjacent paths of the tour (see
+/// atsp_model::exchange()): a path moved elsewhere without inverting
+/// it, the reversal free 3-opt move. Evaluated in O(1).
+class atsp_exchange_segments : public mets::move
+{
+public:
+  atsp_exchange_segments(int first, int middle, int last)
+    : p1(first), p2(middle), p3(last)
+  { }
+
+  void change(int first, int middle, int last)
+  {
+    p1 = first;
+    p2 = middle;
+    p3 = last;
+  }
+
+  mets::gol_type evaluate(mets::feasible_solution& s)
+  {
+    const atsp_model& model = static_cast<const atsp_model&>(s);
+    return (mets::gol_type)model.exchange_cost(p1, p2, p3);
+  }
+
+  void apply(mets::feasible_solution& s)
+  { static_cast<atsp_model&>(s).exchange(p1, p2, p3); }
+
+  void unapply(mets::feasible_solution& s)
+  { static_cast<atsp_model&>(s).exchange(p1, p1+p3-p2-1, p3); }
+
+protected:
+  int p1;
+  int p2;
+  int p3;
+};
+
+/// @brief Base of the neighborhoods generated on the fly.
+///
+/// refresh() evaluates the moves in place and leaves in the
+/// neighborhood the first improving one only, if any: the one a first
+/// improvement local_search would have made. Nothing is allocated,
+/// the memory is O(1) in the size of the neighborhood.
+///
+/// With don't look bits (see atsp_active_queues, candidate lists are
+/// required) refresh() only looks at the moves around the first
+/// active city of the queue of the neighborhood: the city is
+/// deactivated when none of them improves the tour, and once a move
+/// has been made the cities around its cuts are activated again.
+class atsp_neighborhood : public mets::move_manager
+{
+public:
+  atsp_neighborhood(int size, const atsp_candidates* candidates)
+    : move_manager(), size_m(size), candidates_m(candidates), active_m(0),
+      queue_m(0), expected_m(-1)
+  { }
+
+  /// @brief Dtor, the move is not owned by the manager.
+  virtual ~atsp_neighborhood() { moves_m.clear(); }
+
+  /// @brief Uses the given queue of the don't look bits.
+  void dont_look_bits(atsp_active_queues* active, int queue)
+  {
+    assert(!active || candidates_m);
+    active_m = active;
+    queue_m = queue;
+    expected_m = -1;
+  }
+
+  /// @brief Looks for the first improving move.
+  void refresh(mets::feasible_solution& s)
+  {
+    atsp_model& model = static_cast<atsp_model&>(s);
+    const int64_t cost = (int64_t)model.cost_function();
+    moves_m.clear();
+    if(!active_m)
+      {
+	scan(model, cost);
+	return;
+      }
+    // the move left last time has been made
+    if(cost == expected_m)
+      for(int ii(0); ii != 4; ++ii)
+	{
+	  active_m->activate(cut_cities_m[ii]);
+	  active_m->activate_around(model, cuts_m[ii]);
+	}
+    expected_m = -1;
+    int city;
+    while(active_m->front(queue_m, city))
+      {
+	if(scan(model, cost, city))
+	  return;
+	active_m->pop(queue_m);
+      }
+  }
+
+private:
+  atsp_neighborhood(const atsp_neighborhood&);
+  atsp_neighborhood& operator=(const atsp_neighborhood&);
+
+protected:
+  // Looks for the first improving move of the whole neighborhood
+  virtual bool scan(atsp_model& model, int64_t cost) = 0;
+
+  // Looks for the first improving move around a city (candidate
+  // lists only)
+  virtual bool scan(atsp_model& model, int64_t cost, int city) = 0;
+
+  // Leaves the move in the neighborhood if its value improves the
+  // tour. The move cuts the tour at the positions a, b, c and d.
+  bool keep(mets::move& move, const atsp_model& model, int64_t cost,
+	    int64_t value, int a, int b, int c, int d)
+  {
+    if(value >= cost)
+      return false;
+    moves_m.push_back(&move);
+    if(active_m)
+      {
+	expected_m = value;
+	cuts_m[0] = a;
+	cuts_m[1] = b;
+	cuts_m[2] = c;
+	cuts_m[3] = d;
+	for(int ii(0); ii != 4; ++ii)
+	  cut_cities_m[ii] = model.city(cuts_m[ii]);
+      }
+    return true;
+  }
+
+  int size_m;
+  const atsp_candidates* candidates_m;
+  atsp_active_queues* active_m;
+  int queue_m;
+  int64_t expected_m;
+  int cuts_m[4];
+  int cut_cities_m[4];
+};
+
+/// @brief The subsequence inversion neighborhood (2-opt), generated
+/// on the fly: the inversions from..to for every from and every other
+/// to, from then to in increasing order.
+///
+/// With candidate lists only the inversions introducing a candidate
+/// arc on either end of the path are evaluated, O(nk) of them, and
+/// the inversions wrapping around the end of the permutation are not.
+class invert_neighborhood : public atsp_neighborhood
+{
+public:
+  invert_neighborhood(int size, const atsp_candidates* candidates = 0)
+    : atsp_neighborhood(size, candidates), move_m(0, 1), inversions_m()
+  { }
+
+protected:
+  bool scan(atsp_model& model, int64_t cost)
+  {
+    if(candidates_m)
+      {
+	candidates_m->inversions(model, inversions_m);
+	return scan_inversions(model, cost);
+      }
+    for(int ii(0); ii!=size_m; ++ii)
+      for(int jj(0); jj!=size_m; ++jj)
+	if(ii != jj && try_move(model, cost, ii, jj))
+	  return true;
+    return false;
+  }
+
+  bool scan(atsp_model& model, int64_t cost, int city)
+  {
+    candidates_m->inversions(model, city, inversions_m);
+    return scan_inversions(model, cost);
+  }
+
+  bool scan_inversions(atsp_model& model, int64_t cost)
+  {
+    for(unsigned int ii(0); ii != inversions_m.size(); ++ii)
+      if(try_move(model, cost, inversions_m[ii].first,
+		  inversions_m[ii].second))
+	return true;
+    return false;
+  }
+
+  bool try_move(atsp_model& model, int64_t cost, int ii, int jj)
+  {
+    move_m.change(ii, jj);
+    return keep(move_m, model, cost, (int64_t)move_m.evaluate(model),
+		ii, jj, ii, jj);
+  }
+
+  atsp_invert_subsequence move_m;
+  std::vector< std::pair<int, int> > inversions_m;
+};
+
+/// @brief The Or-opt neighborhood: a path of one to max_length cities
+/// moved before or after any other city of the tour, generated on the
+/// fly.
+///
+/// A pass is O(n^2) moves, each evaluated in O(1): unlike the
+/// inversions, whose cost changes with every arc of the inverted path
+/// on asymmetric instances, only the three arcs around the path
+/// change.
+///
+/// With candidate lists a path is only moved after one of the
+/// candidate predecessors of its first city or before one of the
+/// candidate successors of its last one, O(nk) moves. Around a city
+/// the paths starting or ending with it are moved.
+class or_opt_neighborhood : public atsp_neighborhood
+{
+public:
+  or_opt_neighborhood(int size, int max_length = 3,
+		      const atsp_candidates* candidates = 0)
+    : atsp_neighborhood(size, candidates), max_length_m(max_length),
+      move_m(0, 0, 1)
+  { }
+
+protected:
+  bool scan(atsp_model& model, int64_t cost)
+  {
+    for(int length(1); length <= max_length_m; ++length)
+      for(int ii(0); ii+length <= size_m; ++ii)
+	if(scan_path(model, cost, ii, ii+length-1))
+	  return true;
+    return false;
+  }
+
+  bool scan(atsp_model& model, int64_t cost, int city)
+  {
+    if(city == model.depot())
+      return false;
+    const int pos = model.position(city);
+    for(int length(1); length <= max_length_m; ++length)
+      if((pos+length <= size_m
+	  && scan_path(model, cost, pos, pos+length-1))
+	 || (length > 1 && pos-length+1 >= 0
+	     && scan_path(model, cost, pos-length+1, pos)))
+	return true;
+    return false;
+  }
+
+  // Moves the path ii..jj
+  bool scan_path(const atsp_model& model, int64_t cost, int ii, int jj)
+  {
+    if(candidates_m)
+      {
+	const int k = candidates_m->k();
+	const int* in = candidates_m->incoming(model.city(ii));
+	const int* out = candidates_m->outgoing(model.city(jj));
+	for(int cc(0); cc != k; ++cc)
+	  if(move_after(model, cost, ii, jj, model.position(in[cc]))
+	     || move_after(model, cost, ii, jj,
+			   (out[cc] == model.depot() ? size_m
+			    : model.position(out[cc])) - 1))
+	    return true;
+	return false;
+      }
+    for(int kk(-1); kk != size_m; ++kk)
+      if(move_after(model, cost, ii, jj, kk))
+	return true;
+    return false;
+  }
+
+  // Moves the path ii..jj after position kk (-1 for the depot) if it
+  // improves the tour
+  bool move_after(const atsp_model& model, int64_t cost,
+		  int ii, int jj, int kk)
+  {
+    int first = ii, middle = jj, last = kk;
+    if(kk < ii-1)
+      {
+	first = kk+1;
+	middle = ii-1;
+	last = jj;
+      }
+    else if(kk <= jj)
+      return false;
+    move_m.change(first, middle, last);
+    return keep(move_m, model, cost,
+		model.exchange_cost(first, middle, last),
+		first, middle, middle+1, last);
+  }
+
+  int max_length_m;
+  atsp_exchange_segments move_m;
+};
+
+/// @brief The segment insertion neighborhood: any two adjacent paths
+/// of the tour exchanged, that is any path moved elsewhere without
+/// inverting it, generated on the fly.
+///
+/// A pass is O(n^3) moves, each evaluated in O(1).
+///
+/// With candidate lists the exchange of first..middle and
+/// middle+1..last is only evaluated when the arc from the city at last
+/// to the one at first is a candidate, and one of the two other arcs
+/// it introduces is a candidate too: O(nk^2) moves. Around a city the
+/// moves where it is at first or at last are evaluated.
+class segment_insertion_neighborhood : public atsp_neighborhood
+{
+public:
+  segment_insertion_neighborhood(int size,
+				 const atsp_candidates* candidates = 0)
+    : atsp_neighborhood(size, candidates), move_m(0, 0, 1)
+  { }
+
+protected:
+  bool scan(atsp_model& model, int64_t cost)
+  {
+    if(candidates_m)
+      {
+	for(int ii(0); ii != size_m; ++ii)
+	  if(scan_first(model, cost, ii))
+	    return true;
+	return false;
+      }
+    for(int ii(0); ii != size_m; ++ii)
+      for(int jj(ii); jj+1 != size_m; ++jj)
+	for(int kk(jj+1); kk != size_m; ++kk)
+	  if(exchange(model, cost, ii, jj, kk))
+	    return true;
+    return false;
+  }
+
+  bool scan(atsp_model& model, int64_t cost, int city)
+  {
+    if(city == model.depot())
+      return false;
+    const int pos = model.position(city);
+    if(scan_first(model, cost, pos))
+      return true;
+    const int* first = candidates_m->outgoing(city);
+    for(unsigned int cc(0); cc != candidates_m->k(); ++cc)
+      {
+	const int ii = model.position(first[cc]);
+	if(ii >= 0 && ii < pos && scan_closing(model, cost, ii, pos))
+	  return true;
+      }
+    return false;
+  }
+
+  // The moves with ii at first and a candidate arc into it
+  bool scan_first(const atsp_model& model, int64_t cost, int ii)
+  {
+    const int* last = candidates_m->incoming(model.city(ii));
+    for(unsigned int cc(0); cc != candidates_m->k(); ++cc)
+      {
+	const int kk = model.position(last[cc]);
+	if(kk > ii && scan_closing(model, cost, ii, kk))
+	  return true;
+      }
+    return false;
+  }
+
+  // The moves with ii at first and kk at last, and one more
+  // candidate arc
+  bool scan_closing(const atsp_model& model, int64_t cost, int ii, int kk)
+  {
+    // before -> first city of the second path
+    const int* second = candidates_m->outgoing
+      (ii ? model.city(ii-1) : model.depot());
+    // last city of the first path -> after
+    const int* first = candidates_m->incoming
+      (kk+1 != size_m ? model.city(kk+1) : model.depot());
+    for(unsigned int dd(0); dd != candidates_m->k(); ++dd)
+      if(exchange(model, cost, ii, model.position(second[dd])-1, kk)
+	 || exchange(model, cost, ii, model.position(first[dd]), kk))
+	return true;
+    return false;
+  }
+
+  // Exchanges ii..jj and jj+1..kk if it improves the tour
+  bool exchange(const atsp_model& model, int64_t cost,
+		int ii, int jj, int kk)
+  {
+    if(jj < ii || jj >= kk)
+      return false;
+    move_m.change(ii, jj, kk);
+    return keep(move_m, model, cost, model.exchange_cost(ii, jj, kk),
+		ii, jj, jj+1, kk);
+  }
+
+  atsp_exchange_segments move_m;
+};
+
+/// @brief The inversions of invert_neighborhood, each one followed
+/// by the swap of two adjacent cities, generated on the fly: the
+/// moves (from, to, at) for every distinct from, to and at, in
+/// increasing order of from, then to, then at.
+///
+/// With candidate lists only the inversions of invert_neighborhood
+/// introducing a candidate arc are followed by a swap, and only by
+/// the swaps of two cities next to one of the arcs the inversion cuts:
+/// a swap farther away changes other arcs, and would improve the tour
+/// on its own. That makes O(nk) moves (O(k) around a city).
+class three_opt_neighborhood : public atsp_neighborhood
+{
+public:
+  three_opt_neighborhood(int size, const atsp_candidates* candidates = 0)
+    : atsp_neighborhood(size, candidates), move_m(0, 1, 0, size),
+      inversions_m()
+  { }
+
+protected:
+  bool scan(atsp_model& model, int64_t cost)
+  {
+    if(candidates_m)
+      {
+	candidates_m->inversions(model, inversions_m);
+	return scan_inversions(model, cost);
+      }
+    for(int ii(0); ii!=size_m; ++ii)
+      for(int jj(0); jj!=size_m; ++jj)
+	for(int kk(0); kk!=size_m; ++kk)
+	  if(try_move(model, cost, ii, jj, kk))
+	    return true;
+    return false;
+  }
+
+  bool scan(atsp_model& model, int64_t cost, int city)
+  {
+    candidates_m->inversions(model, city, inversions_m);
+    return scan_inversions(model, cost);
+  }
+
+  // The swap of kk and kk+1 changes the arcs from kk-1 to kk+2: the
+  // ones sharing a city with the cuts before from and after to are
+  // those with kk in from-3..from+1 or in to-2..to+2.
+  bool scan_inversions(atsp_model& model, int64_t cost)
+  {
+    for(unsigned int ii(0); ii != inversions_m.size(); ++ii)
+      {
+	const int from = inversions_m[ii].first;
+	const int to = inversions_m[ii].second;
+	const int last = std::min(from+1, size_m-1);
+	for(int kk(std::max(0, from-3)); kk <= last; ++kk)
+	  if(try_move(model, cost, from, to, kk))
+	    return true;
+	for(int kk(std::max(last+1, to-2)); kk <= std::min(to+2, size_m-1);
+	    ++kk)
+	  if(try_move(model, cost, from, to, kk))
+	    return true;
+      }
+    return false;
+  }
+
+  // Evaluates the move (ii, jj, kk) and keeps it if it improves the
+  // tour
+  bool try_move(atsp_model& model, int64_t cost, int ii, int jj, int kk)
+  {
+    if(ii == jj || ii == kk || jj == kk)
+      return false;
+    move_m.change(ii, jj, kk, size_m);
+    return keep(move_m, model, cost, (int64_t)move_m.evaluate(model),
+		ii, jj, kk, (kk+1)%size_m);
+  }
+
+  atsp_three_opt move_m;
+  std::vector< std::pair<int, int> > inversions_m;
+};
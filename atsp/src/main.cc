@@ -2,16 +2,27 @@
 #include <cstdlib>
 #include <fstream>
 #include <vector>
+#include <getopt.h>
 
 #include <metslib/mets.h>
 
 #include "atsp_model.hpp"
+#include "atsp_neighborhood.hpp"
 
 using namespace std;
 
 void usage()
 {
-  cerr << "atsp tsplib.dat" << endl;
+  cerr << "atsp [options] tsplib.dat" << endl
+       << "  -k, --candidates K  only try the moves adding one of the K"
+       << endl
+       << "                      cheapest arcs into or out of a city"
+       << endl
+       << "                      (default 0, all the moves)" << endl
+       << "  -d, --dont-look     only look at the moves around the cities"
+       << endl
+       << "                      whose arcs have changed (requires -k)"
+       << endl;
   ::exit(1);
 }
 
@@ -43,8 +54,27 @@ protected:
 int main(int argc, char* argv[]) 
 {
 
-  if(argc != 2) usage();
-  ifstream in(argv[1]);
+  unsigned int candidates = 0;
+  bool dont_look = false;
+
+  static struct option long_options[] = {
+    {"candidates", required_argument, 0, 'k'},
+    {"dont-look", no_argument, 0, 'd'},
+    {0, 0, 0, 0}
+  };
+  int opt;
+  while((opt = getopt_long(argc, argv, "dk:", long_options, 0)) != -1)
+    {
+      switch(opt)
+	{
+	case 'k': candidates = atoi(optarg); break;
+	case 'd': dont_look = true; break;
+	default: usage();
+	}
+    }
+
+  if(optind != argc-1 || (dont_look && !candidates)) usage();
+  ifstream in(argv[optind]);
   if(!in.is_open()) usage();
 
   // random number generator from C++ TR1 extension
@@ -63,11 +93,31 @@ int main(int argc, char* argv[])
   // best ever solution 
   atsp_model optimum(problem_instance);
 
+  // candidate lists of the neighborhoods, if any
+  atsp_candidates* lists = 0;
+  if(candidates)
+    lists = new atsp_candidates(problem_instance, candidates);
+
   // Neighborhood made of all possibile subsequence inversions.
-  // It's the 2-opt neighborhood
-  std::vector<mets::move_manager*> neighborhoods;
-  neighborhoods.push_back(new mets::invert_full_neighborhood(N));
-  neighborhoods.push_back(new three_opt_full_neighborhood(N));
+  // It's the 2-opt neighborhood, followed by the reversal free ones
+  // (Or-opt and segment insertion) and by the 3-opt one
+  std::vector<atsp_neighborhood*> neighborhoods;
+  neighborhoods.push_back(new invert_neighborhood(N, lists));
+  neighborhoods.push_back(new or_opt_neighborhood(N, 3, lists));
+  neighborhoods.push_back(new segment_insertion_neighborhood(N, lists));
+  neighborhoods.push_back(new three_opt_neighborhood(N, lists));
+
+  // don't look bits, a queue of active cities for each neighborhood
+  atsp_active_queues* active = 0;
+  if(dont_look)
+    {
+      active = new atsp_active_queues(N+1, neighborhoods.size());
+      for(unsigned int ii = 0; ii != neighborhoods.size(); ++ii)
+	neighborhoods[ii]->dont_look_bits(active, ii);
+    }
+
+  // the best tour of the start, before its perturbation
+  std::vector<int> tour;
 
   // log to standard error
   logger g(clog);
@@ -75,6 +125,8 @@ int main(int argc, char* argv[])
   for(unsigned int starts = 0; starts != 3; ++starts) {
     // generate a random starting point
     problem_instance.random_shuffle(rng);
+    if(active)
+      active->activate_all();
 
     // best solution instance (records the best solution of each iteration)
     atsp_model major_best_solution(problem_instance);
@@ -113,8 +165,17 @@ int main(int argc, char* argv[])
 
       
       problem_instance = major_best_solution;
+      // the search restarts from the best tour, a local optimum when
+      // it was recorded: the arcs the perturbation leaves to it need
+      // not be looked at again, even where the tour the local
+      // searches converged to differs from it
+      if(active)
+	tour = problem_instance.permutation();
       // perturbate point with random swaps
       problem_instance.perturbate(N/3, rng);
+      // and look again around the cities whose arcs have changed
+      if(active)
+	active->activate_changes(tour, problem_instance);
     }
     
     cout << "Best of this run/so far: " 
@@ -1,147 +1,805 @@
 #include <iostream>
-#include <cstdlib>
 #include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
 #include <vector>
+#include <getopt.h>
+#include <unistd.h>
 
 #include <metslib/mets.hh>
 
 #include "qap_model.hpp"
+#include "qap_io.hpp"
+#include "qap_neighborhood.hpp"
+#include "qap_parallel.hpp"
+#include "qap_tabu_list.hpp"
+#include "qap_termination.hpp"
+#include "qap_trace.hpp"
+#include "qap_its.hpp"
+#include "qap_checkpoint.hpp"
+#include "qap_islands.hpp"
+#include "qap_cycle.hpp"
 
 using namespace std;
 
 void usage()
 {
-  cerr << "qap qaplib.dat" << endl;
+  cerr << "itsqap [options] qaplib.dat" << endl
+       << "itsqap [options] --batch manifest" << endl
+       << "  -b, --batch MANIFEST      solve the instances listed in"
+       << endl
+       << "                            MANIFEST (file [seed] per line) on"
+       << endl
+       << "                            a pool of threads, a JSON line each"
+       << endl
+       << "  -c, --cache               use (and write) a binary cache of the"
+       << endl
+       << "                            instance, qaplib.dat.cache" << endl
+       << "  -C, --checkpoint FILE     save the state of the search to FILE"
+       << endl
+       << "  -d, --delta-table         keep an O(1) table of swap deltas" << endl
+       << "  -e, --evaluations E       stop after about E swap evaluations"
+       << endl
+       << "  -f, --full-neighborhood   scan all the swaps at each iteration"
+       << endl
+       << "  -i, --trace-improvements  trace only the improving moves" << endl
+       << "  -j, --scan-threads N      scan all the swaps using N threads"
+       << endl
+       << "  -k, --trace-every K       trace every K-th move" << endl
+       << "  -l, --time-limit S        stop after S seconds" << endl
+       << "  -m, --migration M         islands exchange their elite"
+       << endl
+       << "                            solutions every M minor iterations"
+       << endl
+       << "                            (default 10)" << endl
+       << "  -n, --islands K           run K cooperating islands with"
+       << endl
+       << "                            different tenures and perturbations"
+       << endl
+       << "  -o, --trace FILE          write a binary trace of the moves"
+       << endl
+       << "                            (see qaptrace)" << endl
+       << "  -p, --checkpoint-interval S" << endl
+       << "                            checkpoint every S seconds (default 60)"
+       << endl
+       << "  -r, --resume              resume the search saved to the"
+       << endl
+       << "                            checkpoint, if any (not with"
+       << endl
+       << "                            --islands)" << endl
+       << "  -y, --cycles L            scan all the swaps and the 3-cycles"
+       << endl
+       << "                            extending the L best ones" << endl
+       << "  -t, --threads N           run the restarts on N threads (the"
+       << endl
+       << "                            batch on N threads, one per CPU by"
+       << endl
+       << "                            default)" << endl
+       << "  -s, --seed S              seed of the random number generators"
+       << endl;
   ::exit(1);
 }
 
-typedef mets::swap_neighborhood<std::tr1::mt19937> neighborhood_t;
+typedef mets::swap_neighborhood<std::tr1::mt19937> sampled_neighborhood_t;
+typedef qap_full_neighborhood<qap_robust_tabu_list> full_neighborhood_t;
+typedef qap_parallel_neighborhood<qap_robust_tabu_list>
+parallel_neighborhood_t;
+typedef qap_cycle_neighborhood<qap_robust_tabu_list> cycle_neighborhood_t;
+
+/// @brief State shared by the workers of an iterated tabu search.
+struct its_context
+{
+  const qap_model* problem;
+  qap_shared_recorder* incumbent;
+  // time and evaluation budgets of the run, and its deadline alone
+  // (polled between the searches)
+  mets::termination_criteria_chain* budget;
+  const qap_deadline_termination_criteria* deadline;
+  bool use_delta_table;
+  bool use_full_neighborhood;
+  unsigned int scan_threads;
+  // candidate swaps extended to 3-cycles (none if 0)
+  unsigned int cycle_candidates;
+  unsigned long seed;
+  unsigned int starts;
+  // next start to be taken by a worker
+  unsigned int next_start;
+  // binary trace of the moves, one ring per worker (null if the
+  // moves are not traced)
+  qap_trace* trace;
+  unsigned int trace_every;
+  bool trace_improvements;
+  // periodic checkpoints, with a slot per worker (null if the search
+  // is not saved): it hands out the starts instead of next_start
+  qap_checkpoint* checkpoint;
+  // progress messages, and the mutex held while a line is written
+  // (null if the log is not shared by several workers)
+  std::ostream* log;
+  pthread_mutex_t* log_mutex;
+  // the mailboxes of the elite solutions of the islands, one per
+  // worker (null if the workers do not cooperate), and the minor
+  // iterations between two migrations
+  qap_elite_mailbox* mailbox;
+  unsigned int migration;
+};
+
+/// @brief Runs the minor iterations of a start (see
+/// qap_minor_iterations()), tracing the moves to the ring of the
+/// worker if asked and notifying the observer, if any, after each
+/// minor iteration.
+template<typename neighborhood_t>
+void minor_iterations(const its_context& context,
+		      unsigned int worker,
+		      qap_model& problem_instance,
+		      mets::best_ever_solution& majorit_recorder,
+		      qap_model& minorit_solution,
+		      neighborhood_t& neighborhood,
+		      qap_robust_tabu_list& tabu_list,
+		      mets::best_ever_criteria& aspiration_criteria,
+		      std::tr1::mt19937& rng,
+		      std::tr1::uniform_int<int>& tlg,
+		      std::tr1::uniform_int<int>& psg,
+		      qap_stop_latch& stop,
+		      qap_its_progress& progress,
+		      qap_its_observer* observer)
+{
+  if(!context.trace)
+    {
+      qap_minor_iterations(problem_instance, majorit_recorder,
+			   minorit_solution, neighborhood, tabu_list,
+			   aspiration_criteria,
+			   static_cast<mets::search_listener<neighborhood_t>*>(0),
+			   *context.log, rng, tlg, psg, &stop, &progress,
+			   observer, context.log_mutex);
+      return;
+    }
+  qap_trace_listener<neighborhood_t> g(context.trace->ring(worker),
+				       context.trace_every,
+				       context.trace_improvements);
+  qap_minor_iterations(problem_instance, majorit_recorder, minorit_solution,
+		       neighborhood, tabu_list, aspiration_criteria, &g,
+		       *context.log, rng, tlg, psg, &stop, &progress, observer,
+		       context.log_mutex);
+}
+
+
+/// @brief The solutions and the tabu list of a worker, the buffers
+/// of all its starts (and of all the instances of a batch).
+struct its_scratch
+{
+  its_scratch()
+    : problem_instance(), majorit_solution(), minorit_solution(),
+      tabu_list(0, 7)
+  { }
+
+  /// @brief Sets the buffers up for an instance, reusing their
+  /// memory.
+  void prepare(const qap_model& problem, bool use_delta_table)
+  {
+    if(problem_instance.delta_table() != use_delta_table)
+      problem_instance.delta_table(use_delta_table);
+    problem_instance.copy_from(problem);
+    majorit_solution.copy_from(problem);
+    minorit_solution.copy_from(problem);
+    tabu_list.resize(problem.size());
+  }
+
+  // the working solution
+  qap_model problem_instance;
+  // best solution instances for recording storage for the best
+  // known solutions of the major and of the minor iterations.
+  qap_model majorit_solution;
+  qap_model minorit_solution;
+  // the attribute based tabu list of Ro-TS (cleared at each start)
+  qap_robust_tabu_list tabu_list;
+};
+
+/// @brief Runs starts (major iterations) of the iterated tabu search
+/// until all of them have been taken.
+///
+/// Each worker owns its working solution, neighborhood, tabu list
+/// and recorders; the random number generator is seeded again at
+/// each start, so that the outcome of a start does not depend on the
+/// worker running it. Only the incumbent is shared. The solutions
+/// recording the best of a start and of a minor iteration are buffers
+/// of the worker (its_scratch), reused by all the starts.
+///
+/// When the search is checkpointed the state of the start is saved in
+/// the slot of the worker after each minor iteration (its random
+/// number generator reseeded, see qap_align_rng()), and a start
+/// that was in progress in a loaded checkpoint goes on from its saved
+/// state: the working and best solutions, the tabu list, the progress
+/// of the minor iterations and the random number generator. The best
+/// cost of the aspiration criterion is taken to be the best cost of
+/// the start.
+///
+/// When the workers are islands (see qap_islands.hpp), each one has
+/// its own tenure and perturbation ranges, and the workers exchange
+/// their elite solutions around a ring every context->migration minor
+/// iterations.
+struct its_worker
+{
+  explicit its_worker(its_context* c) : context(c), index(0) { }
+
+  void operator()()
+  {
+    its_scratch scratch;
+    run(scratch);
+  }
+
+  /// @brief Runs the starts with the given buffers.
+  void run(its_scratch& scratch)
+  {
+    // random number generator from C++ TR1 extension
+    std::tr1::mt19937 rng;
+
+    scratch.prepare(*context->problem, context->use_delta_table);
+    qap_model& problem_instance = scratch.problem_instance;
+
+    unsigned int N = problem_instance.size();
 
-struct logger : public mets::search_listener<neighborhood_t>
+    const qap_island_ranges ranges(N, index, context->mailbox
+				   ? context->mailbox->islands() : 1);
+    std::tr1::uniform_int<int> tlg(ranges.tenure_min, ranges.tenure_max);
+    std::tr1::uniform_int<int> psg(ranges.swaps_min, ranges.swaps_max);
+
+    // A neighborhood made of random swaps
+    sampled_neighborhood_t
+      sampled_neighborhood(rng, qap_its_settings::sampled_swaps(N));
+
+    qap_model& majorit_solution = scratch.majorit_solution;
+    qap_model& minorit_solution = scratch.minorit_solution;
+
+    // use framework provided strategies, and the attribute based
+    // tabu list of Ro-TS
+    qap_robust_tabu_list& tabu_list = scratch.tabu_list;
+    mets::best_ever_criteria aspiration_criteria;
+
+    // set once the budget of the run is exhausted
+    qap_stop_latch stop(context->budget, context->deadline);
+
+    // saves the start in the slot of the worker
+    qap_checkpoint_observer* checkpoint = 0;
+    if(context->checkpoint)
+      checkpoint = new qap_checkpoint_observer(*context->checkpoint,
+					       index, problem_instance,
+					       majorit_solution, tabu_list,
+					       rng);
+    // exchanges elite solutions with the other islands, then saves
+    qap_migration_observer* migration = 0;
+    if(context->mailbox)
+      migration = new qap_migration_observer(*context->mailbox, index,
+					     context->migration,
+					     problem_instance,
+					     majorit_solution, rng, psg,
+					     checkpoint);
+    qap_its_observer* observer = migration;
+    if(!observer)
+      observer = checkpoint;
+
+    for(;;)
+      {
+	unsigned int start;
+	const qap_start_state* resumed = 0;
+	if(context->checkpoint)
+	  {
+	    if(stop.poll()
+	       || !context->checkpoint->take(index, start, resumed))
+	      break;
+	  }
+	else
+	  {
+	    start = __sync_fetch_and_add(&context->next_start, 1);
+	    if(start >= context->starts || stop.poll())
+	      break;
+	  }
+
+	qap_its_progress progress;
+	tabu_list.clear();
+	aspiration_criteria.reset();
+	if(resumed)
+	  {
+	    rng = resumed->rng;
+	    problem_instance.permutation(resumed->working);
+	    majorit_solution.permutation(resumed->best);
+	    tabu_list.restore(resumed->tabu, resumed->tabu_iteration);
+	    mets::swap_elements any(0, 1);
+	    aspiration_criteria.accept(majorit_solution, any, 0.0);
+	    progress = resumed->progress;
+	  }
+	else
+	  // generate a random starting point
+	  qap_its_start(problem_instance, *context->problem,
+			majorit_solution, tabu_list, rng,
+			context->seed + start, tlg);
+	mets::best_ever_solution majorit_recorder(majorit_solution);
+      
+	if(context->scan_threads > 1)
+	  {
+	    // All the N(N-1)/2 swaps, scanned by scan_threads threads
+	    parallel_neighborhood_t neighborhood(tabu_list,
+						 aspiration_criteria,
+						 context->scan_threads);
+	    minor_iterations(*context, index, problem_instance,
+			     majorit_recorder, minorit_solution, neighborhood,
+			     tabu_list, aspiration_criteria, rng, tlg, psg,
+			     stop, progress, observer);
+	  }
+	else if(context->cycle_candidates)
+	  {
+	    // All the swaps, and the 3-cycles of the best ones
+	    cycle_neighborhood_t neighborhood(tabu_list, aspiration_criteria,
+					      context->cycle_candidates);
+	    minor_iterations(*context, index, problem_instance,
+			     majorit_recorder, minorit_solution, neighborhood,
+			     tabu_list, aspiration_criteria, rng, tlg, psg,
+			     stop, progress, observer);
+	  }
+	else if(context->use_full_neighborhood)
+	  {
+	    // All the N(N-1)/2 swaps, scanned without move objects
+	    full_neighborhood_t neighborhood(tabu_list, aspiration_criteria);
+	    minor_iterations(*context, index, problem_instance,
+			     majorit_recorder, minorit_solution, neighborhood,
+			     tabu_list, aspiration_criteria, rng, tlg, psg,
+			     stop, progress, observer);
+	  }
+	else
+	  minor_iterations(*context, index, problem_instance,
+			   majorit_recorder, minorit_solution,
+			   sampled_neighborhood, tabu_list, aspiration_criteria,
+			   rng, tlg, psg, stop, progress, observer);
+      
+	context->incumbent->accept(majorit_recorder.best_seen());
+	// a stopped start stays in progress in the checkpoint
+	if(context->checkpoint && !stop.stopped())
+	  context->checkpoint->done(index);
+      
+	if(context->log_mutex)
+	  pthread_mutex_lock(context->log_mutex);
+	*context->log << "Best of this run/so far: " 
+		      << majorit_solution.cost_function()  
+		      << "/"
+		      << context->incumbent->best_cost() << endl;
+	if(context->log_mutex)
+	  pthread_mutex_unlock(context->log_mutex);
+      }
+    delete migration;
+    delete checkpoint;
+  }
+
+  its_context* context;
+  // the trace ring, checkpoint slot and island of the worker
+  unsigned int index;
+};
+
+/// @brief An instance of a batch, with the seed to solve it with.
+struct its_job
 {
-  explicit
-  logger(std::ostream& o) 
-    : mets::search_listener<neighborhood_t>(), 
-      iteration(0), 
-      os(o) 
+  its_job() : filename(), seed(0) { }
+
+  std::string filename;
+  unsigned long seed;
+};
+
+/// @brief A batch of instances and the options to solve them with.
+struct its_batch
+{
+  its_batch()
+    : jobs(), queues(0), use_cache(false), use_delta_table(false),
+      use_full_neighborhood(false), cycle_candidates(0), time_limit(0.0),
+      evaluations(0), output()
   { }
-  
-  void 
-  update(mets::abstract_search<neighborhood_t>* as) 
+
+  std::vector<its_job> jobs;
+  qap_work_queues* queues;
+  bool use_cache;
+  bool use_delta_table;
+  bool use_full_neighborhood;
+  unsigned int cycle_candidates;
+  double time_limit;
+  unsigned long evaluations;
+  // serializes the result lines
+  pthread_mutex_t output;
+
+private:
+  its_batch(const its_batch&);
+  its_batch& operator=(const its_batch&);
+};
+
+/// @brief Runs whole iterated tabu searches of the instances of a
+/// batch, one after the other, until no job is left.
+///
+/// The workers of the batch share nothing but the queues of the jobs
+/// and the output: each job is loaded, solved with all its starts on
+/// the thread of the worker (the time and evaluation budgets are
+/// those of each job) and written as a JSON line. The solutions and
+/// the tabu list of the worker are reused from one job to the next.
+struct its_batch_worker
+{
+  explicit its_batch_worker(its_batch* b) : batch(b), index(0) { }
+
+  void operator()()
+  {
+    its_scratch scratch;
+    std::ostream quiet(0);
+    unsigned int job;
+    while(batch->queues->take(index, job))
+      solve(batch->jobs[job], scratch, quiet);
+  }
+
+  void solve(const its_job& job, its_scratch& scratch, std::ostream& log)
   {
-    const mets::feasible_solution& p = as->working();
-    if(as->step() == mets::abstract_search<neighborhood_t>::MOVE_MADE)
+    const double started = qap_deadline_termination_criteria::now();
+    std::ostringstream line;
+    line << "{\"instance\": \"" << json_escape(job.filename)
+	 << "\", \"seed\": " << job.seed;
+    qap_instance_ptr instance;
+    try
       {
-	os << iteration++ << " " 
-	   << static_cast<const mets::evaluable_solution&>(p).cost_function() << "\n";
+	instance = batch->use_cache ? qap_load_cached(job.filename)
+	  : qap_load_dat(job.filename);
       }
+    catch(std::exception& e)
+      {
+	line << ", \"error\": \"" << json_escape(e.what()) << "\"}";
+	write(line.str());
+	return;
+      }
+    qap_model problem_instance(instance);
+    const unsigned int N = problem_instance.size();
+    qap_model incumbent_solution(problem_instance);
+    qap_shared_recorder incumbent_recorder(incumbent_solution);
+    const unsigned long neighbors = batch->cycle_candidates
+      ? N*(N-1)/2 + 2*batch->cycle_candidates*(N-2)
+      : batch->use_full_neighborhood ? N*(N-1)/2
+      : qap_its_settings::sampled_swaps(N);
+    qap_deadline_termination_criteria deadline(0, batch->time_limit);
+    qap_evaluations_termination_criteria budget(&deadline,
+						batch->evaluations,
+						neighbors);
+
+    its_context context;
+    context.problem = &problem_instance;
+    context.incumbent = &incumbent_recorder;
+    context.budget = &budget;
+    context.deadline = &deadline;
+    context.use_delta_table = batch->use_delta_table;
+    context.use_full_neighborhood = batch->use_full_neighborhood;
+    context.scan_threads = 1;
+    context.cycle_candidates = batch->cycle_candidates;
+    context.seed = job.seed;
+    context.starts = qap_its_settings::starts(N);
+    context.next_start = 0;
+    context.trace = 0;
+    context.trace_every = 1;
+    context.trace_improvements = false;
+    context.checkpoint = 0;
+    context.log = &log;
+    context.log_mutex = 0;
+    context.mailbox = 0;
+    context.migration = 0;
+    its_worker worker(&context);
+    worker.run(scratch);
+
+    line << ", \"n\": " << N
+	 << ", \"cost\": " << int64_t(incumbent_solution.cost_function())
+	 << ", \"seconds\": "
+	 << qap_deadline_termination_criteria::now() - started
+	 << ", \"permutation\": [";
+    for(unsigned int ii = 0; ii != N; ++ii)
+      line << (ii ? ", " : "") << incumbent_solution.location(ii) + 1;
+    line << "]}";
+    write(line.str());
   }
-  
-protected:
-  int iteration;
-  ostream& os;
+
+  // Writes a result line, whole.
+  void write(const std::string& line)
+  {
+    pthread_mutex_lock(&batch->output);
+    cout << line << endl;
+    pthread_mutex_unlock(&batch->output);
+  }
+
+  static std::string json_escape(const std::string& s)
+  {
+    std::string escaped;
+    for(unsigned int ii = 0; ii != s.size(); ++ii)
+      {
+	const unsigned char c = s[ii];
+	if(c == '"' || c == '\\')
+	  escaped += '\\';
+	if(c < 0x20)
+	  {
+	    char code[8];
+	    std::sprintf(code, "\\u%04x", c);
+	    escaped += code;
+	  }
+	else
+	  escaped += c;
+      }
+    return escaped;
+  }
+
+  its_batch* batch;
+  // the job queue of the worker
+  unsigned int index;
 };
 
+/// @brief Reads a batch manifest: one instance per line, optionally
+/// followed by a seed (the default one otherwise). Empty lines and
+/// lines starting with # are skipped.
+bool read_manifest(const char* filename, unsigned long seed,
+		   std::vector<its_job>& jobs)
+{
+  ifstream manifest(filename);
+  if(!manifest)
+    return false;
+  std::string text;
+  while(std::getline(manifest, text))
+    {
+      std::istringstream fields(text);
+      its_job job;
+      if(!(fields >> job.filename) || job.filename[0] == '#')
+	continue;
+      if(!(fields >> job.seed))
+	job.seed = seed;
+      jobs.push_back(job);
+    }
+  return true;
+}
+
+/// @brief Solves the instances of a batch on a pool of threads,
+/// writing a JSON line per instance.
+int run_batch(its_batch& batch, unsigned int threads)
+{
+  qap_work_queues queues(threads, batch.jobs.size());
+  batch.queues = &queues;
+  pthread_mutex_init(&batch.output, 0);
+  std::vector<its_batch_worker> workers(threads, its_batch_worker(&batch));
+  for(unsigned int ii = 0; ii != workers.size(); ++ii)
+    workers[ii].index = ii;
+  qap_run_workers(workers);
+  pthread_mutex_destroy(&batch.output);
+  return 0;
+}
+
 
 int main(int argc, char* argv[]) 
 {
 
-  if(argc != 2) usage();
-  ifstream in(argv[1]);
-  if(!in.is_open()) usage();
+  bool use_cache = false;
+  bool use_delta_table = false;
+  bool use_full_neighborhood = false;
+  unsigned int scan_threads = 1;
+  unsigned int threads = 0;
+  double time_limit = 0;
+  unsigned long evaluations = 0;
+  const char* trace_file = 0;
+  unsigned int trace_every = 1;
+  bool trace_improvements = false;
+  const char* checkpoint_file = 0;
+  double checkpoint_interval = 60;
+  bool resume = false;
+  const char* manifest = 0;
+  unsigned int islands = 0;
+  unsigned int migration = 10;
+  unsigned int cycle_candidates = 0;
+  unsigned long seed = time(NULL);
+  static struct option long_options[] = {
+    {"batch", required_argument, 0, 'b'},
+    {"cache", no_argument, 0, 'c'},
+    {"checkpoint", required_argument, 0, 'C'},
+    {"checkpoint-interval", required_argument, 0, 'p'},
+    {"resume", no_argument, 0, 'r'},
+    {"delta-table", no_argument, 0, 'd'},
+    {"full-neighborhood", no_argument, 0, 'f'},
+    {"evaluations", required_argument, 0, 'e'},
+    {"scan-threads", required_argument, 0, 'j'},
+    {"time-limit", required_argument, 0, 'l'},
+    {"migration", required_argument, 0, 'm'},
+    {"islands", required_argument, 0, 'n'},
+    {"trace", required_argument, 0, 'o'},
+    {"trace-every", required_argument, 0, 'k'},
+    {"trace-improvements", no_argument, 0, 'i'},
+    {"cycles", required_argument, 0, 'y'},
+    {"threads", required_argument, 0, 't'},
+    {"seed", required_argument, 0, 's'},
+    {0, 0, 0, 0}
+  };
+  int opt;
+  while((opt = getopt_long(argc, argv, "b:cC:de:fij:k:l:m:n:o:p:rt:s:y:", long_options, 0)) != -1)
+    switch(opt)
+      {
+      case 'b': manifest = optarg; break;
+      case 'c': use_cache = true; break;
+      case 'C': checkpoint_file = optarg; break;
+      case 'p': checkpoint_interval = atof(optarg); break;
+      case 'r': resume = true; break;
+      case 'd': use_delta_table = true; break;
+      case 'f': use_full_neighborhood = true; break;
+      case 'e': evaluations = strtod(optarg, 0); break;
+      case 'j': scan_threads = std::max(1, atoi(optarg)); break;
+      case 'l': time_limit = atof(optarg); break;
+      case 'm': migration = std::max(1, atoi(optarg)); break;
+      case 'n': islands = std::max(1, atoi(optarg)); break;
+      case 'o': trace_file = optarg; break;
+      case 'k': trace_every = std::max(1, atoi(optarg)); break;
+      case 'i': trace_improvements = true; break;
+      case 'y': cycle_candidates = std::max(1, atoi(optarg)); break;
+      case 't': threads = std::max(1, atoi(optarg)); break;
+      case 's': seed = strtoul(optarg, 0, 10); break;
+      default: usage();
+      }
 
-  // random number generator from C++ TR1 extension
-  std::tr1::mt19937 rng(time(NULL));
+  if(manifest)
+    {
+      // the searches of a batch are neither traced nor saved
+      if(optind != argc || checkpoint_file || trace_file
+	 || scan_threads > 1 || islands)
+	usage();
+      its_batch batch;
+      if(!read_manifest(manifest, seed, batch.jobs))
+	{
+	  cerr << "Cannot open " << manifest << endl;
+	  ::exit(1);
+	}
+      batch.use_cache = use_cache;
+      batch.use_delta_table = use_delta_table;
+      batch.use_full_neighborhood = use_full_neighborhood;
+      batch.cycle_candidates = cycle_candidates;
+      batch.time_limit = time_limit;
+      batch.evaluations = evaluations;
+      if(!threads)
+	threads = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+      return run_batch(batch, std::min<size_t>(threads, batch.jobs.size()));
+    }
 
-  // user define problem
-  qap_model problem_instance;
+  // the trace and the parallel scan only know swaps, and a checkpoint
+  // holds neither the migrations nor the elites of the islands
+  if(optind != argc-1 || (resume && !checkpoint_file)
+     || (resume && islands > 1) || checkpoint_interval <= 0
+     || (cycle_candidates && (trace_file || scan_threads > 1)))
+    usage();
+  // one thread per island
+  threads = islands ? islands : std::max(1u, threads);
 
-  // read problem instance from standard input (no check is made)
-  in >> problem_instance;
+  // user define problem
+  qap_instance_ptr instance;
+  try
+    {
+      instance = use_cache ? qap_load_cached(argv[optind])
+	: qap_load_dat(argv[optind]);
+    }
+  catch(std::exception& e)
+    {
+      cerr << e.what() << endl;
+      ::exit(1);
+    }
+  qap_model problem_instance(instance);
 
   unsigned int N = problem_instance.size();
 
-  std::tr1::uniform_int<int> tlg(7, N*7);
-  std::tr1::uniform_int<int> psg(7, N/2);
+  // the saved search, if asked and if there is one: the instance
+  // must be the same (its size and the cost of the identity), the
+  // seed and the incumbent are those of the saved search
+  qap_checkpoint_data saved;
+  saved.n = N;
+  // each island makes at least a start
+  saved.starts = std::max(qap_its_settings::starts(N), islands);
+  saved.identity_cost = int64_t(problem_instance.cost_function());
+  if(resume && ::access(checkpoint_file, F_OK) == 0)
+    {
+      try
+	{
+	  qap_read_checkpoint(checkpoint_file, saved);
+	}
+      catch(std::exception& e)
+	{
+	  cerr << e.what() << endl;
+	  ::exit(1);
+	}
+      if(saved.n != N
+	 || saved.identity_cost != int64_t(problem_instance.cost_function()))
+	{
+	  cerr << checkpoint_file << " is the checkpoint of another instance"
+	       << endl;
+	  ::exit(1);
+	}
+      seed = saved.seed;
+    }
+  saved.seed = seed;
 
   // best solution instance for recording
   // storage for the best known solution.
   qap_model incumbent_solution(problem_instance);
-  mets::best_ever_solution incumbent_recorder(incumbent_solution);
+  if(!saved.incumbent.empty())
+    incumbent_solution.permutation(saved.incumbent);
+  qap_shared_recorder incumbent_recorder(incumbent_solution);
+
+  // optional budgets, shared by all the workers: an iteration
+  // evaluates the swaps of the neighborhood
+  const unsigned long neighbors = cycle_candidates
+    ? N*(N-1)/2 + 2*cycle_candidates*(N-2)
+    : (scan_threads > 1 || use_full_neighborhood) ? N*(N-1)/2
+    : qap_its_settings::sampled_swaps(N);
+  qap_deadline_termination_criteria deadline(0, time_limit);
+  qap_evaluations_termination_criteria budget(&deadline, evaluations,
+					      neighbors);
 
-  // A neighborhood made of random swaps
-  neighborhood_t
-    neighborhood(rng, N*12);
+  its_context context;
+  context.problem = &problem_instance;
+  context.incumbent = &incumbent_recorder;
+  context.budget = &budget;
+  context.deadline = &deadline;
+  context.use_delta_table = use_delta_table;
+  context.use_full_neighborhood = use_full_neighborhood;
+  context.scan_threads = scan_threads;
+  context.cycle_candidates = cycle_candidates;
+  context.seed = seed;
+  context.starts = saved.starts;
+  context.next_start = 0;
+  context.trace_every = trace_every;
+  context.trace_improvements = trace_improvements;
+  pthread_mutex_t log_mutex;
+  pthread_mutex_init(&log_mutex, 0);
+  context.log = &cout;
+  context.log_mutex = &log_mutex;
 
-  // log to standard error
-  logger g(clog);
+  // the restarts are independent: run them on a pool of workers,
+  // or on islands exchanging their elite solutions
+  std::vector<its_worker> workers(std::min(threads, context.starts),
+				  its_worker(&context));
+  for(unsigned int ii = 0; ii != workers.size(); ++ii)
+    workers[ii].index = ii;
+  qap_elite_mailbox* mailbox = 0;
+  if(islands)
+    mailbox = new qap_elite_mailbox(workers.size(), N);
+  context.mailbox = mailbox;
+  context.migration = migration;
 
-  for(unsigned int starts = 0; starts != int(sqrt(N)); ++starts) 
+  // the binary trace of the moves, if asked, with a ring per worker
+  qap_trace* trace = 0;
+  try
     {
-      // generate a random starting point
-      mets::random_shuffle(problem_instance, rng);
+      if(trace_file)
+	trace = new qap_trace(trace_file, workers.size());
+    }
+  catch(std::exception& e)
+    {
+      cerr << e.what() << endl;
+      ::exit(1);
+    }
+  context.trace = trace;
 
-      // best solution instance for recording storage for the best
-      // known solution of the major iteration.
-      qap_model majorit_solution(problem_instance);
-      mets::best_ever_solution majorit_recorder(majorit_solution);
+  // the checkpoints, if asked, with a slot per worker
+  qap_checkpoint* checkpoint = 0;
+  try
+    {
+      if(checkpoint_file)
+	checkpoint = new qap_checkpoint(checkpoint_file, checkpoint_interval,
+					workers.size(), saved,
+					incumbent_recorder);
+    }
+  catch(std::exception& e)
+    {
+      cerr << e.what() << endl;
+      ::exit(1);
+    }
+  context.checkpoint = checkpoint;
 
-      // use framework provided strategies
-      mets::simple_tabu_list tabu_list(tlg(rng));
-      mets::best_ever_criteria aspiration_criteria;
-      
-      // Do minor iterations with a max no-improve criterion
-      mets::noimprove_termination_criteria 
-	minor_it_criteria(100);
-      
-      int perturbation_size = N;
+  qap_run_workers(workers);
+  pthread_mutex_destroy(&log_mutex);
+  // flush the trace
+  delete trace;
+  // save the final state
+  if(checkpoint && !checkpoint->close())
+    cerr << "Cannot write " << checkpoint_file << endl;
+  delete checkpoint;
+  delete mailbox;
 
-      while(!minor_it_criteria(majorit_recorder.best_seen())) 
-	{
-	  
-	  // best solution instance for recording storage for the best
-	  // known solution of the major iteration.
-	  qap_model minorit_solution(problem_instance);
-	  mets::best_ever_solution minorit_recorder(minorit_solution);
-	  
-	  // random tabu list tenure
-	  tabu_list.tenure(tlg(rng));
-	  
-	  // fixed number of non improving moves before termination
-	  mets::noimprove_termination_criteria 
-	    termination_criteria(200);
-	  
-	  // the search algorithm
-	  mets::tabu_search<neighborhood_t> algorithm(problem_instance, 
-						      minorit_recorder, 
-						      neighborhood, 
-						      tabu_list, 
-						      aspiration_criteria, 
-						      termination_criteria);
-	  
-	  algorithm.attach(g);
-	  std::cout << "New iteration with tenure: " 
-		    << tabu_list.tenure() << std::endl;
-
-	  algorithm.search();
-	  
-	  majorit_recorder.accept(minorit_recorder.best_seen());
-	  problem_instance.copy_from(majorit_recorder.best_seen());
-
-
-	  perturbation_size = psg(rng);
-	  // perturbate point with random swaps
-	  mets::perturbate(problem_instance, perturbation_size, rng);
-	}
-      
-      incumbent_recorder.accept(majorit_recorder.best_seen());
-      
-      cout << "Best of this run/so far: " 
-	   << majorit_solution.cost_function()  
-	   << "/"
-	   << incumbent_solution.cost_function() << endl;
-      
-    }
   // write solution to standard output
   cout << N << " " <<  incumbent_solution.cost_function() << endl
        << incumbent_solution << endl;
@@ -1,93 +1,238 @@
 #include <iostream>
 #include <cstdlib>
-#include <fstream>
 #include <vector>
+#include <getopt.h>
 
 #include <metslib/mets.hh>
 
 #include "qap_model.hpp"
+#include "qap_io.hpp"
+#include "qap_neighborhood.hpp"
+#include "qap_parallel.hpp"
+#include "qap_tabu_list.hpp"
+#include "qap_termination.hpp"
+#include "qap_trace.hpp"
+#include "qap_cycle.hpp"
+#include "qap_ts.hpp"
 
 using namespace std;
 
 void usage()
 {
-  cerr << "qap qaplib.dat" << endl;
+  cerr << "tsqap [options] qaplib.dat" << endl
+       << "  -c, --cache               use (and write) a binary cache of the"
+       << endl
+       << "                            instance, qaplib.dat.cache" << endl
+       << "  -d, --delta-table         keep an O(1) table of swap deltas" << endl
+       << "  -e, --evaluations E       stop after about E swap evaluations"
+       << endl
+       << "  -f, --full-neighborhood   scan all the swaps at each iteration"
+       << endl
+       << "  -i, --trace-improvements  trace only the improving moves" << endl
+       << "  -j, --scan-threads N      scan all the swaps using N threads"
+       << endl
+       << "  -k, --trace-every K       trace every K-th move" << endl
+       << "  -l, --time-limit S        stop after S seconds" << endl
+       << "  -o, --trace FILE          write a binary trace of the moves"
+       << endl
+       << "                            (see qaptrace)" << endl
+       << "  -y, --cycles L            scan all the swaps and the 3-cycles"
+       << endl
+       << "                            extending the L best ones" << endl
+       << "  -s, --seed S              seed of the random number generator"
+       << endl;
   ::exit(1);
 }
 
 typedef mets::swap_neighborhood<std::tr1::mt19937> swap_neighborhood_t;
+typedef qap_full_neighborhood<qap_robust_tabu_list> full_neighborhood_t;
+typedef qap_parallel_neighborhood<qap_robust_tabu_list>
+parallel_neighborhood_t;
+typedef qap_cycle_neighborhood<qap_robust_tabu_list> cycle_neighborhood_t;
 
-struct logger : public mets::search_listener<swap_neighborhood_t>
+template<typename neighborhood_t>
+void search(qap_model& problem_instance,
+	    mets::solution_recorder& recorder,
+	    neighborhood_t& neighborhood,
+	    mets::tabu_list_chain& tabu_list,
+	    mets::aspiration_criteria_chain& aspiration_criteria,
+	    mets::termination_criteria_chain& termination_criteria,
+	    qap_trace* trace,
+	    unsigned int trace_every,
+	    bool trace_improvements)
 {
-  explicit
-  logger(std::ostream& o) 
-    : mets::search_listener<swap_neighborhood_t>(), 
-      iteration(0), 
-      os(o) 
-  { }
-  
-  void 
-  update(mets::abstract_search<swap_neighborhood_t>* as) 
-  {
-    const mets::feasible_solution& p = as->working();
-    if(as->step() == mets::abstract_search<swap_neighborhood_t>::MOVE_MADE)
-      {
-	os << iteration++ << " " 
-	   << static_cast<const mets::evaluable_solution&>(p).cost_function() << "\n";
-      }
-  }
+  // the search algorithm
+  mets::tabu_search<neighborhood_t> algorithm(problem_instance, 
+					      recorder, 
+					      neighborhood, 
+					      tabu_list, 
+					      aspiration_criteria, 
+					      termination_criteria);
   
-protected:
-  int iteration;
-  ostream& os;
-};
+  // binary trace of the moves, if asked
+  qap_trace_listener<neighborhood_t>* g = 0;
+  if(trace)
+    {
+      g = new qap_trace_listener<neighborhood_t>(trace->ring(0),
+						 trace_every,
+						 trace_improvements);
+      algorithm.attach(*g);
+    }
+  algorithm.search();
+  delete g;
+}
 
 
 int main(int argc, char* argv[]) 
 {
 
-  if(argc != 2) usage();
-  ifstream in(argv[1]);
-  if(!in.is_open()) usage();
+  bool use_cache = false;
+  bool use_delta_table = false;
+  bool use_full_neighborhood = false;
+  unsigned int scan_threads = 1;
+  unsigned int cycle_candidates = 0;
+  double time_limit = 0;
+  unsigned long evaluations = 0;
+  const char* trace_file = 0;
+  unsigned int trace_every = 1;
+  bool trace_improvements = false;
+  unsigned long seed = time(NULL);
+  static struct option long_options[] = {
+    {"cache", no_argument, 0, 'c'},
+    {"delta-table", no_argument, 0, 'd'},
+    {"full-neighborhood", no_argument, 0, 'f'},
+    {"evaluations", required_argument, 0, 'e'},
+    {"scan-threads", required_argument, 0, 'j'},
+    {"time-limit", required_argument, 0, 'l'},
+    {"trace", required_argument, 0, 'o'},
+    {"trace-every", required_argument, 0, 'k'},
+    {"trace-improvements", no_argument, 0, 'i'},
+    {"cycles", required_argument, 0, 'y'},
+    {"seed", required_argument, 0, 's'},
+    {0, 0, 0, 0}
+  };
+  int opt;
+  while((opt = getopt_long(argc, argv, "cde:fij:k:l:o:s:y:", long_options, 0)) != -1)
+    switch(opt)
+      {
+      case 'c': use_cache = true; break;
+      case 'd': use_delta_table = true; break;
+      case 'f': use_full_neighborhood = true; break;
+      case 'e': evaluations = strtod(optarg, 0); break;
+      case 'j': scan_threads = std::max(1, atoi(optarg)); break;
+      case 'l': time_limit = atof(optarg); break;
+      case 'o': trace_file = optarg; break;
+      case 'k': trace_every = std::max(1, atoi(optarg)); break;
+      case 'i': trace_improvements = true; break;
+      case 'y': cycle_candidates = std::max(1, atoi(optarg)); break;
+      case 's': seed = strtoul(optarg, 0, 10); break;
+      default: usage();
+      }
+
+  // the trace and the parallel scan only know swaps
+  if(optind != argc-1
+     || (cycle_candidates && (trace_file || scan_threads > 1)))
+    usage();
+  qap_instance_ptr instance;
+  try
+    {
+      instance = use_cache ? qap_load_cached(argv[optind])
+	: qap_load_dat(argv[optind]);
+    }
+  catch(std::exception& e)
+    {
+      cerr << e.what() << endl;
+      ::exit(1);
+    }
 
   // random number generator from C++ TR1 extension
-  std::tr1::mt19937 rng(time(NULL));
+  std::tr1::mt19937 rng(seed);
 
   // user defined problem
-  qap_model problem_instance;
-  in >> problem_instance;
+  qap_model problem_instance(instance);
+  problem_instance.delta_table(use_delta_table);
   unsigned int N = problem_instance.size();
 
   // best solution instance used to record the best known solution.
   qap_model incumbent_solution(problem_instance);
   mets::best_ever_solution incumbent_recorder(incumbent_solution);
 
-  // A neighborhood made of 2N random swaps
-  swap_neighborhood_t neighborhood(rng, sqrt(N)*N);
-
   // generate a random starting point
   mets::random_shuffle(problem_instance, rng);
 
-  // use framework provided strategies
-  mets::simple_tabu_list tabu_list(N*sqrt(N));
+  // the attribute based tabu list of Ro-TS, with its tenure drawn
+  // in [0.9 N, 1.1 N] as in Taillard's paper, and framework provided
+  // strategies
+  qap_robust_tabu_list tabu_list(N, qap_ts_settings::tenure(N));
+  tabu_list.randomize(rng);
   mets::best_ever_criteria aspiration_criteria;
       
+  // optional time and evaluation budgets: an iteration evaluates the
+  // swaps of the neighborhood
+  const unsigned long neighbors = cycle_candidates
+    ? N*(N-1)/2 + 2*cycle_candidates*(N-2)
+    : (scan_threads > 1 || use_full_neighborhood)
+    ? N*(N-1)/2 : qap_ts_settings::sampled_swaps(N);
+  qap_deadline_termination_criteria deadline(0, time_limit);
+  qap_evaluations_termination_criteria budget(&deadline, evaluations,
+					      neighbors);
+
   // fixed number of non improving moves before termination
-  mets::noimprove_termination_criteria termination_criteria(1000);
+  mets::noimprove_termination_criteria
+    termination_criteria(qap_ts_settings::max_noimprove, &budget);
+
+  // the binary trace of the moves, if asked
+  qap_trace* trace = 0;
+  try
+    {
+      if(trace_file)
+	trace = new qap_trace(trace_file, 1);
+    }
+  catch(std::exception& e)
+    {
+      cerr << e.what() << endl;
+      ::exit(1);
+    }
 	  
-  // the search algorithm
-  mets::tabu_search<swap_neighborhood_t> algorithm(problem_instance, 
-						   incumbent_recorder, 
-						   neighborhood, 
-						   tabu_list, 
-						   aspiration_criteria, 
-						   termination_criteria);
-  
-  // log to standard error
-  logger g(clog);
-  algorithm.attach(g);
-  algorithm.search();
+  if(scan_threads > 1)
+    {
+      // All the N(N-1)/2 swaps, scanned by scan_threads threads
+      parallel_neighborhood_t neighborhood(tabu_list, aspiration_criteria,
+					   scan_threads);
+      search(problem_instance, incumbent_recorder, neighborhood,
+	     tabu_list, aspiration_criteria, termination_criteria,
+	     trace, trace_every, trace_improvements);
+    }
+  else if(cycle_candidates)
+    {
+      // All the swaps, and the 3-cycles of the best ones
+      cycle_neighborhood_t neighborhood(tabu_list, aspiration_criteria,
+					cycle_candidates);
+      search(problem_instance, incumbent_recorder, neighborhood,
+	     tabu_list, aspiration_criteria, termination_criteria,
+	     trace, trace_every, trace_improvements);
+    }
+  else if(use_full_neighborhood)
+    {
+      // All the N(N-1)/2 swaps, scanned without move objects
+      full_neighborhood_t neighborhood(tabu_list, aspiration_criteria);
+      search(problem_instance, incumbent_recorder, neighborhood,
+	     tabu_list, aspiration_criteria, termination_criteria,
+	     trace, trace_every, trace_improvements);
+    }
+  else
+    {
+      // A neighborhood made of N*sqrt(N) random swaps
+      swap_neighborhood_t neighborhood(rng,
+				       qap_ts_settings::sampled_swaps(N));
+      search(problem_instance, incumbent_recorder, neighborhood,
+	     tabu_list, aspiration_criteria, termination_criteria,
+	     trace, trace_every, trace_improvements);
+    }
 	  
+  // flush the trace
+  delete trace;
+
   // write solution to standard output
   cout << fixed << N << " " <<  incumbent_solution.cost_function() << endl
        << incumbent_solution << endl;
@@ -0,0 +1,531 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <tr1/random>
+#include <metslib/mets.hh>
+
+#include "qap_model.hpp"
+#include "qap_io.hpp"
+#include "qap_parallel.hpp"
+#include "qap_tabu_list.hpp"
+#include "qap_its.hpp"
+
+/// @brief The header of an iterated tabu search checkpoint.
+///
+/// It is followed by the incumbent permutation (n int32_t) and by the
+/// starts in progress, each one a qap_checkpoint_start record. The
+/// starts below next_start that are not in progress are done.
+struct qap_checkpoint_header
+{
+  enum { byte_order_mark = 0x01020304, format_version = 1 };
+
+  char magic[8];		// "QAPCHKPT"
+  uint32_t byte_order;		// byte_order_mark, as written
+  uint32_t version;		// format_version
+  uint32_t n;
+  uint32_t starts;
+  uint32_t next_start;
+  uint32_t in_progress;		// start records
+  uint64_t seed;
+  int64_t identity_cost;	// cost of the identity, to tell instances apart
+  int64_t incumbent_cost;
+  char padding[8];
+};
+
+/// @brief A start in progress, as saved in a checkpoint.
+///
+/// If saved is set it is followed by the state of the random number
+/// generator (rng_size bytes, as written by operator<<), the working
+/// solution and the best solution of the start (n int32_t each) and
+/// the table of the tabu list (n x n uint32_t). Otherwise the start
+/// had not finished its first minor iteration and it is made again
+/// from scratch.
+struct qap_checkpoint_start
+{
+  uint32_t start;
+  uint32_t saved;
+  double best;			// see qap_its_progress
+  uint32_t left;
+  uint32_t tabu_iteration;	// see qap_robust_tabu_list::iteration()
+  uint32_t rng_size;
+  uint32_t padding;
+};
+
+/// @brief The state of a start between two of its minor iterations.
+struct qap_start_state
+{
+  qap_start_state()
+    : start(0), saved(false), progress(), working(), best(), tabu(),
+      tabu_iteration(0), rng()
+  { }
+
+  unsigned int start;
+  bool saved;			// false: nothing but the start is known
+  qap_its_progress progress;
+  std::vector<int> working;	// the next minor iteration starts here
+  std::vector<int> best;	// best solution of the start
+  std::vector<unsigned int> tabu;
+  unsigned int tabu_iteration;
+  std::tr1::mt19937 rng;
+};
+
+/// @brief Everything a checkpoint records about a run.
+struct qap_checkpoint_data
+{
+  qap_checkpoint_data()
+    : n(0), starts(0), next_start(0), seed(0), identity_cost(0),
+      incumbent(), in_progress()
+  { }
+
+  unsigned int n;
+  unsigned int starts;
+  unsigned int next_start;
+  uint64_t seed;
+  int64_t identity_cost;
+  std::vector<int> incumbent;
+  std::vector<qap_start_state> in_progress;
+};
+
+/// @brief Writes a checkpoint, atomically replacing any previous one.
+/// Returns false if it could not be written.
+inline bool
+qap_write_checkpoint(const std::string& filename,
+		     const qap_checkpoint_data& data, int64_t incumbent_cost)
+{
+  qap_checkpoint_header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, "QAPCHKPT", 8);
+  header.byte_order = qap_checkpoint_header::byte_order_mark;
+  header.version = qap_checkpoint_header::format_version;
+  header.n = data.n;
+  header.starts = data.starts;
+  header.next_start = data.next_start;
+  header.in_progress = data.in_progress.size();
+  header.seed = data.seed;
+  header.identity_cost = data.identity_cost;
+  header.incumbent_cost = incumbent_cost;
+
+  // same as the instance cache: write to a temporary file, then
+  // rename it, so that a crash never leaves a partial checkpoint
+  std::string tmpname = filename + ".XXXXXX";
+  int fd = ::mkstemp(&tmpname[0]);
+  if(fd == -1)
+    return false;
+  ::fchmod(fd, 0644);
+  FILE* out = ::fdopen(fd, "wb");
+  if(!out)
+    {
+      ::close(fd);
+      ::unlink(tmpname.c_str());
+      return false;
+    }
+  bool ok = std::fwrite(&header, sizeof(header), 1, out) == 1
+    && std::fwrite(&data.incumbent[0], sizeof(int32_t), data.n, out)
+    == data.n;
+  for(unsigned int ii = 0; ok && ii != data.in_progress.size(); ++ii)
+    {
+      const qap_start_state& s = data.in_progress[ii];
+      std::ostringstream rng;
+      if(s.saved)
+	rng << s.rng;
+      const std::string text = rng.str();
+      qap_checkpoint_start record;
+      std::memset(&record, 0, sizeof(record));
+      record.start = s.start;
+      record.saved = s.saved;
+      record.best = s.progress.best;
+      record.left = s.progress.left;
+      record.tabu_iteration = s.tabu_iteration;
+      record.rng_size = text.size();
+      ok = std::fwrite(&record, sizeof(record), 1, out) == 1;
+      if(ok && s.saved)
+	ok = std::fwrite(text.data(), 1, text.size(), out) == text.size()
+	  && std::fwrite(&s.working[0], sizeof(int32_t), data.n, out)
+	  == data.n
+	  && std::fwrite(&s.best[0], sizeof(int32_t), data.n, out) == data.n
+	  && std::fwrite(&s.tabu[0], sizeof(uint32_t), s.tabu.size(), out)
+	  == s.tabu.size();
+    }
+  ok = (std::fclose(out) == 0) && ok;
+  if(ok)
+    ok = ::rename(tmpname.c_str(), filename.c_str()) == 0;
+  if(!ok)
+    ::unlink(tmpname.c_str());
+  return ok;
+}
+
+// Copies size bytes at p to dest and moves p forward, unless they
+// would overrun end.
+inline bool
+qap_read_bytes(const char*& p, const char* end, void* dest, size_t size)
+{
+  if(size_t(end - p) < size)
+    return false;
+  std::memcpy(dest, p, size);
+  p += size;
+  return true;
+}
+
+// Reads a permutation of n elements.
+inline bool
+qap_read_permutation(const char*& p, const char* end, unsigned int n,
+		     std::vector<int>& pi)
+{
+  pi.resize(n);
+  if(!qap_read_bytes(p, end, &pi[0], n * sizeof(int32_t)))
+    return false;
+  std::vector<bool> seen(n, false);
+  for(unsigned int ii = 0; ii != n; ++ii)
+    {
+      if(pi[ii] < 0 || pi[ii] >= int(n) || seen[pi[ii]])
+	return false;
+      seen[pi[ii]] = true;
+    }
+  return true;
+}
+
+/// @brief Reads a checkpoint written by qap_write_checkpoint().
+///
+/// Throws a std::runtime_error if the file cannot be read or is not a
+/// valid checkpoint.
+inline void
+qap_read_checkpoint(const std::string& filename, qap_checkpoint_data& data)
+{
+  const std::string bad = "Bad checkpoint " + filename;
+  qap_mapped_file file(filename);
+  const char* p = file.begin();
+  const char* end = file.end();
+  qap_checkpoint_header header;
+  if(!qap_read_bytes(p, end, &header, sizeof(header))
+     || std::memcmp(header.magic, "QAPCHKPT", 8)
+     || header.byte_order != qap_checkpoint_header::byte_order_mark
+     || header.version != qap_checkpoint_header::format_version
+     || header.n == 0
+     || header.n > file.size() / sizeof(int32_t)
+     || header.next_start > header.starts
+     || header.in_progress > header.starts)
+    throw std::runtime_error(bad);
+  const unsigned int n = header.n;
+  data.n = n;
+  data.starts = header.starts;
+  data.next_start = header.next_start;
+  data.seed = header.seed;
+  data.identity_cost = header.identity_cost;
+  if(!qap_read_permutation(p, end, n, data.incumbent))
+    throw std::runtime_error(bad);
+  data.in_progress.resize(header.in_progress);
+  for(unsigned int ii = 0; ii != header.in_progress; ++ii)
+    {
+      qap_start_state& s = data.in_progress[ii];
+      qap_checkpoint_start record;
+      if(!qap_read_bytes(p, end, &record, sizeof(record))
+	 || record.start >= header.next_start)
+	throw std::runtime_error(bad);
+      s.start = record.start;
+      s.saved = record.saved;
+      if(!s.saved)
+	continue;
+      s.progress.best = record.best;
+      s.progress.left = record.left;
+      s.tabu_iteration = record.tabu_iteration;
+      if(size_t(end - p) < record.rng_size)
+	throw std::runtime_error(bad);
+      std::istringstream rng(std::string(p, record.rng_size));
+      p += record.rng_size;
+      rng >> s.rng;
+      if(!rng
+	 || !qap_read_permutation(p, end, n, s.working)
+	 || !qap_read_permutation(p, end, n, s.best)
+	 || size_t(end - p) < size_t(n) * n * sizeof(uint32_t))
+	throw std::runtime_error(bad);
+      s.tabu.resize(n * n);
+      qap_read_bytes(p, end, &s.tabu[0], n * n * sizeof(uint32_t));
+    }
+  if(p != end)
+    throw std::runtime_error(bad);
+}
+
+/// @brief Periodic checkpoints of an iterated tabu search, written
+/// asynchronously.
+///
+/// Each worker owns a slot holding the state of its start, copied in
+/// between two minor iterations (see qap_checkpoint_observer): the
+/// copy takes a mutex shared with the writer thread only, and reuses
+/// the buffers of the slot. Every interval seconds, if some state has
+/// changed, the writer thread copies the slots, the start counter and
+/// the incumbent and writes the checkpoint file: the workers never
+/// wait for the disk.
+///
+/// The starts in progress in a loaded checkpoint are handed out first
+/// by take(), then the fresh ones.
+class qap_checkpoint
+{
+public:
+  /// @brief Starts the writer thread. data is the loaded checkpoint
+  /// (or a blank one with the size, starts, seed and identity cost of
+  /// the run), it is swapped out.
+  qap_checkpoint(const std::string& filename, double interval,
+		 unsigned int slots, qap_checkpoint_data& data,
+		 qap_shared_recorder& incumbent)
+    : filename_m(filename), interval_m(interval), data_m(),
+      slots_m(slots), busy_m(slots, false), pending_m(), taken_m(0),
+      incumbent_m(incumbent), best_m(incumbent.best_seen()), changes_m(1),
+      written_m(0), failed_m(false),
+      mutex_m(), wake_m(), writer_m(), stop_m(false)
+  {
+    data_m.n = data.n;
+    data_m.starts = data.starts;
+    data_m.next_start = data.next_start;
+    data_m.seed = data.seed;
+    data_m.identity_cost = data.identity_cost;
+    pending_m.swap(data.in_progress);
+    pthread_mutex_init(&mutex_m, 0);
+    pthread_cond_init(&wake_m, 0);
+    if(pthread_create(&writer_m, 0, &qap_checkpoint::run, this))
+      {
+	pthread_cond_destroy(&wake_m);
+	pthread_mutex_destroy(&mutex_m);
+	throw std::runtime_error("Cannot start the checkpoint writer thread.");
+      }
+  }
+
+  ~qap_checkpoint()
+  {
+    close();
+    pthread_cond_destroy(&wake_m);
+    pthread_mutex_destroy(&mutex_m);
+  }
+
+  /// @brief Stops the writer thread and writes a last checkpoint, once
+  /// the workers are over. Returns false if a checkpoint could not be
+  /// written.
+  bool
+  close()
+  {
+    pthread_mutex_lock(&mutex_m);
+    const bool running = !stop_m;
+    stop_m = true;
+    pthread_cond_signal(&wake_m);
+    pthread_mutex_unlock(&mutex_m);
+    if(running)
+      {
+	pthread_join(writer_m, 0);
+	write();
+      }
+    return !failed_m;
+  }
+
+  /// @brief Takes a start for the worker of a slot, returns false if
+  /// none is left. resumed is set to the saved state of the start, if
+  /// it was in progress in the loaded checkpoint (null otherwise).
+  bool
+  take(unsigned int slot, unsigned int& start,
+       const qap_start_state*& resumed)
+  {
+    bool found = true;
+    resumed = 0;
+    pthread_mutex_lock(&mutex_m);
+    if(taken_m != pending_m.size())
+      {
+	const qap_start_state& s = pending_m[taken_m++];
+	start = s.start;
+	if(s.saved)
+	  resumed = &s;
+      }
+    else if(data_m.next_start < data_m.starts)
+      start = data_m.next_start++;
+    else
+      found = false;
+    if(found)
+      {
+	// in progress from now on, from where it was or from scratch
+	// until saved
+	if(resumed)
+	  slots_m[slot] = *resumed;
+	else
+	  {
+	    slots_m[slot].start = start;
+	    slots_m[slot].saved = false;
+	  }
+	busy_m[slot] = true;
+	++changes_m;
+      }
+    pthread_mutex_unlock(&mutex_m);
+    return found;
+  }
+
+  /// @brief Copies the state of the start of a slot.
+  void
+  save(unsigned int slot, const qap_its_progress& progress,
+       const qap_model& working, const qap_model& best,
+       const qap_robust_tabu_list& tabu_list,
+       const std::tr1::mt19937& rng)
+  {
+    pthread_mutex_lock(&mutex_m);
+    qap_start_state& s = slots_m[slot];
+    s.saved = true;
+    s.progress = progress;
+    s.working = working.permutation();
+    s.best = best.permutation();
+    s.tabu = tabu_list.table();
+    s.tabu_iteration = tabu_list.iteration();
+    s.rng = rng;
+    ++changes_m;
+    pthread_mutex_unlock(&mutex_m);
+  }
+
+  /// @brief Records that the start of a slot is over (call it once
+  /// its best solution has been given to the incumbent).
+  void
+  done(unsigned int slot)
+  {
+    pthread_mutex_lock(&mutex_m);
+    busy_m[slot] = false;
+    ++changes_m;
+    pthread_mutex_unlock(&mutex_m);
+  }
+
+private:
+  qap_checkpoint(const qap_checkpoint&);
+  qap_checkpoint& operator=(const qap_checkpoint&);
+
+  static void*
+  run(void* arg)
+  {
+    static_cast<qap_checkpoint*>(arg)->serve();
+    return 0;
+  }
+
+  // Body of the writer thread: a checkpoint every interval seconds.
+  void
+  serve()
+  {
+    pthread_mutex_lock(&mutex_m);
+    while(!stop_m)
+      {
+	timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	const long nanoseconds =
+	  long((interval_m - long(interval_m)) * 1e9) + deadline.tv_nsec;
+	deadline.tv_sec += long(interval_m) + nanoseconds / 1000000000;
+	deadline.tv_nsec = nanoseconds % 1000000000;
+	pthread_cond_timedwait(&wake_m, &mutex_m, &deadline);
+	if(stop_m)
+	  break;
+	pthread_mutex_unlock(&mutex_m);
+	write();
+	pthread_mutex_lock(&mutex_m);
+      }
+    pthread_mutex_unlock(&mutex_m);
+  }
+
+  // Writes a checkpoint if anything has changed since the last one.
+  void
+  write()
+  {
+    qap_checkpoint_data data;
+    pthread_mutex_lock(&mutex_m);
+    const unsigned long changes = changes_m;
+    if(changes == written_m)
+      {
+	pthread_mutex_unlock(&mutex_m);
+	return;
+      }
+    data.n = data_m.n;
+    data.starts = data_m.starts;
+    data.next_start = data_m.next_start;
+    data.seed = data_m.seed;
+    data.identity_cost = data_m.identity_cost;
+    for(unsigned int ii = 0; ii != slots_m.size(); ++ii)
+      if(busy_m[ii])
+	data.in_progress.push_back(slots_m[ii]);
+    data.in_progress.insert(data.in_progress.end(),
+			    pending_m.begin() + taken_m, pending_m.end());
+    pthread_mutex_unlock(&mutex_m);
+
+    // after the slots: the incumbent has the best of the starts done
+    incumbent_m.copy_best(best_m);
+    data.incumbent = best_m.permutation();
+    if(qap_write_checkpoint(filename_m, data,
+			    int64_t(best_m.cost_function())))
+      written_m = changes;
+    else
+      failed_m = true;
+  }
+
+  std::string filename_m;
+  double interval_m;
+  qap_checkpoint_data data_m;
+  std::vector<qap_start_state> slots_m;
+  std::vector<bool> busy_m;
+  std::vector<qap_start_state> pending_m;
+  unsigned int taken_m;
+  qap_shared_recorder& incumbent_m;
+  qap_model best_m;		// copy of the incumbent, for the writer
+  unsigned long changes_m;
+  unsigned long written_m;	// changes_m at the last checkpoint
+  volatile bool failed_m;
+  pthread_mutex_t mutex_m;
+  pthread_cond_t wake_m;
+  pthread_t writer_m;
+  bool stop_m;
+};
+
+/// @brief Draws a new state for rng from its own output.
+///
+/// The TR1 engines write their state words to a stream but not their
+/// position in them: an engine read back always starts a new block
+/// of words, and it only draws the same numbers as the one written
+/// if that one was at the end of a block. Once reseeded here (624
+/// draws of a copy) the engine is, and a start saved right after can
+/// be resumed with the very same draws. Only the checkpointed runs do
+/// it (see qap_checkpoint_observer): the others draw the plain stream
+/// of the engine.
+inline void
+qap_align_rng(std::tr1::mt19937& rng)
+{
+  // a copy of a const engine: a non-const one would be taken as a
+  // generator to seed from
+  std::tr1::mt19937 draws(static_cast<const std::tr1::mt19937&>(rng));
+  rng.seed(draws);
+}
+
+/// @brief Saves the state of a worker in its slot of a checkpoint
+/// after each minor iteration, once its random number generator has
+/// been reseeded by qap_align_rng().
+class qap_checkpoint_observer : public qap_its_observer
+{
+public:
+  qap_checkpoint_observer(qap_checkpoint& checkpoint, unsigned int slot,
+			  const qap_model& working, const qap_model& best,
+			  const qap_robust_tabu_list& tabu_list,
+			  std::tr1::mt19937& rng)
+    : checkpoint_m(checkpoint), slot_m(slot), working_m(working),
+      best_m(best), tabu_list_m(tabu_list), rng_m(rng)
+  { }
+
+  void
+  minor_iteration_done(const qap_its_progress& progress)
+  {
+    qap_align_rng(rng_m);
+    checkpoint_m.save(slot_m, progress, working_m, best_m, tabu_list_m,
+		      rng_m);
+  }
+
+protected:
+  qap_checkpoint& checkpoint_m;
+  unsigned int slot_m;
+  const qap_model& working_m;
+  const qap_model& best_m;
+  const qap_robust_tabu_list& tabu_list_m;
+  std::tr1::mt19937& rng_m;
+};
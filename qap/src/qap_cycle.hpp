@@ -0,0 +1,147 @@
+#pragma once
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <stdint.h>
+#include <metslib/mets.hh>
+
+#include "qap_model.hpp"
+#include "qap_neighborhood.hpp"
+
+/// @brief The full swap neighborhood compounded with 3-cycles built
+/// on its best swaps.
+///
+/// refresh() scans all the n(n-1)/2 swaps as qap_full_neighborhood
+/// does, and keeps aside the given number of candidate swaps, those
+/// with the lowest deltas, tabu or not. Each candidate (i, j) is then
+/// extended to the 3-cycles (i, j, k) and (j, i, k) for every other
+/// facility k: the swap of i and j followed by the swap of j (or i)
+/// and k, evaluated exactly by qap_model::cycle_delta(): in O(1) from
+/// the placement table when the delta table is enabled, else in O(n).
+/// An iteration costs the swap scan plus 2 * candidates * n cycles,
+/// O(n^2) for a fixed number of candidates either way, but only the
+/// delta table makes the cycles cheaper than the scan. A cycle pays off
+/// when its second swap would not pay alone, which a swap
+/// neighborhood only gets to through tabu moves or perturbations.
+///
+/// Only the best admissible move, swap or cycle, is left in the
+/// neighborhood: the tabu list must know both (e.g.
+/// qap_robust_tabu_list) and the aspiration criteria are queried as
+/// for the swaps. A cycle replaces the best swap only if it is
+/// strictly better.
+template<typename tabu_list_type = mets::tabu_list_chain>
+class qap_cycle_neighborhood
+{
+public:
+  typedef std::vector<mets::move*>::iterator iterator;
+
+  qap_cycle_neighborhood(tabu_list_type& tabu,
+			 mets::aspiration_criteria_chain& aspiration,
+			 unsigned int candidates = 3)
+    : tabu_m(tabu), is_tabu_m(tabu), aspiration_m(aspiration),
+      swap_m(0, 1), cycle_m(0, 1, 2),
+      candidates_m(std::max(1u, candidates)), moves_m()
+  { moves_m.reserve(1); }
+
+  iterator begin() { return moves_m.begin(); }
+  iterator end() { return moves_m.end(); }
+  size_t size() const { return moves_m.size(); }
+
+  /// @brief Scans the swaps and the 3-cycles of their candidates for
+  /// the best admissible move.
+  void
+  refresh(mets::feasible_solution& s)
+  {
+    const qap_model& model = static_cast<const qap_model&>(s);
+    const int n = model.size();
+    const mets::gol_type cost = model.cost_function();
+    qap_swap_choice best;
+    std::fill(candidates_m.begin(), candidates_m.end(), qap_swap_choice());
+    for(int ii = 0; ii < n; ++ii)
+      for(int jj = ii+1; jj < n; ++jj)
+	{
+	  const int64_t delta = model.swap_delta(ii, jj);
+	  keep_candidate(delta, ii, jj);
+	  if(delta >= best.delta)
+	    continue;
+	  if(is_tabu_m(s, ii, jj)
+	     && !aspiration_m(s, is_tabu_m.move(), cost + delta))
+	    continue;
+	  best.delta = delta;
+	  best.i = ii;
+	  best.j = jj;
+	}
+
+    int64_t best_cycle = best.delta;
+    int cycle[3] = { -1, -1, -1 };
+    for(unsigned int cc = 0; cc != candidates_m.size(); ++cc)
+      {
+	const qap_swap_choice& c = candidates_m[cc];
+	if(c.i == -1)
+	  break;
+	for(int turn = 0; turn != 2; ++turn)
+	  {
+	    const int i = turn ? c.j : c.i;
+	    const int j = turn ? c.i : c.j;
+	    for(int kk = 0; kk < n; ++kk)
+	      {
+		if(kk == i || kk == j)
+		  continue;
+		const int64_t delta = model.cycle_delta(i, j, kk);
+		if(delta >= best_cycle)
+		  continue;
+		cycle_m.change(i, j, kk);
+		if(tabu_m.is_tabu(s, cycle_m)
+		   && !aspiration_m(s, cycle_m, cost + delta))
+		  continue;
+		best_cycle = delta;
+		cycle[0] = i;
+		cycle[1] = j;
+		cycle[2] = kk;
+	      }
+	  }
+      }
+
+    moves_m.clear();
+    if(cycle[0] != -1)
+      {
+	cycle_m.change(cycle[0], cycle[1], cycle[2]);
+	moves_m.push_back(&cycle_m);
+      }
+    else if(best.i != -1)
+      {
+	swap_m.change(best.i, best.j);
+	moves_m.push_back(&swap_m);
+      }
+  }
+
+protected:
+  // Keeps the swap among the candidates if its delta is one of the
+  // lowest seen so far (the candidates are sorted by delta).
+  void
+  keep_candidate(int64_t delta, int i, int j)
+  {
+    const unsigned int last = candidates_m.size() - 1;
+    if(candidates_m[last].i != -1 && delta >= candidates_m[last].delta)
+      return;
+    unsigned int pos = last;
+    while(pos && (candidates_m[pos-1].i == -1
+		  || delta < candidates_m[pos-1].delta))
+      {
+	candidates_m[pos] = candidates_m[pos-1];
+	--pos;
+      }
+    candidates_m[pos].delta = delta;
+    candidates_m[pos].i = i;
+    candidates_m[pos].j = j;
+  }
+
+  tabu_list_type& tabu_m;
+  qap_tabu_probe<tabu_list_type> is_tabu_m;
+  mets::aspiration_criteria_chain& aspiration_m;
+  mets::swap_elements swap_m;
+  qap_cycle_move cycle_m;
+  std::vector<qap_swap_choice> candidates_m;
+  std::vector<mets::move*> moves_m;
+};
@@ -0,0 +1,313 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <limits>
+#include <algorithm>
+#include <stdint.h>
+#include <tr1/memory>
+
+/// @brief A square matrix stored row-major in a single, cache line
+/// aligned, buffer.
+///
+/// Each row is padded with zeros up to a multiple of the cache line
+/// size, so that every row starts on a line boundary and can be
+/// streamed by the hardware prefetcher (and loaded with aligned
+/// vector instructions).
+template<typename T>
+class qap_matrix
+{
+public:
+  enum { alignment = 64 };
+
+  qap_matrix() : n_m(0), stride_m(0), data_m(0), owner_m(true) { }
+
+  explicit qap_matrix(unsigned int n)
+    : n_m(0), stride_m(0), data_m(0), owner_m(true)
+  { resize(n); }
+
+  ~qap_matrix() { release(); }
+
+  /// @brief The row stride used for an n x n matrix.
+  ///
+  /// Rows of elements narrower than an int keep at least one element
+  /// of padding: the vector kernels gather them 32 bits at a time, and
+  /// the read of the last element must not leave the row.
+  static unsigned int stride_for(unsigned int n)
+  {
+    const unsigned int per_line = alignment / sizeof(T);
+    const unsigned int min = n + (sizeof(T) < sizeof(int) ? 1 : 0);
+    return (min + per_line - 1) / per_line * per_line;
+  }
+
+  /// @brief Resizes the matrix, previous content is lost and the new
+  /// matrix is zero filled.
+  void resize(unsigned int n)
+  {
+    unsigned int stride = stride_for(n);
+    void* p = 0;
+    if(n && ::posix_memalign(&p, alignment, sizeof(T) * stride * n))
+      throw std::bad_alloc();
+    release();
+    data_m = static_cast<T*>(p);
+    owner_m = true;
+    n_m = n;
+    stride_m = stride;
+    if(n)
+      std::memset(data_m, 0, sizeof(T) * stride_m * n_m);
+  }
+
+  /// @brief Makes the matrix a view on n padded rows stored at data
+  /// (aligned, with stride_for(n) elements per row) that is owned,
+  /// and kept alive, by someone else.
+  void attach(T* data, unsigned int n)
+  {
+    release();
+    data_m = data;
+    owner_m = false;
+    n_m = n;
+    stride_m = stride_for(n);
+  }
+
+  /// @brief Number of rows (and columns).
+  unsigned int size() const { return n_m; }
+
+  /// @brief Distance, in elements, between two consecutive rows.
+  unsigned int stride() const { return stride_m; }
+
+  T* row(unsigned int i) { return data_m + i * stride_m; }
+  const T* row(unsigned int i) const { return data_m + i * stride_m; }
+
+  T& operator()(unsigned int i, unsigned int j)
+  { return data_m[i * stride_m + j]; }
+  const T& operator()(unsigned int i, unsigned int j) const
+  { return data_m[i * stride_m + j]; }
+
+private:
+  qap_matrix(const qap_matrix&);
+  qap_matrix& operator=(const qap_matrix&);
+
+  void release()
+  {
+    if(owner_m)
+      ::free(data_m);
+    data_m = 0;
+  }
+
+  unsigned int n_m;
+  unsigned int stride_m;
+  T* data_m;
+  bool owner_m;
+};
+
+/// @brief Which matrices of an instance are symmetric.
+enum qap_symmetry
+{
+  qap_asymmetric = 0,
+  qap_a_symmetric = 1,
+  qap_b_symmetric = 2,
+  qap_both_symmetric = qap_a_symmetric | qap_b_symmetric
+};
+
+/// @brief The flow (a) and the distance (b) matrices of an instance,
+/// together with their transposes (at and bt) so that the evaluation
+/// kernels can read columns as contiguous rows.
+///
+/// When exactly one of a and b is symmetric, s is the sum of the other
+/// one and of its transpose (see qap_instance::finalize()), otherwise
+/// it is empty.
+template<typename T>
+struct qap_data
+{
+  qap_data() : a(), b(), at(), bt(), s() { }
+
+  void resize(unsigned int n, bool with_s)
+  {
+    a.resize(n); b.resize(n); at.resize(n); bt.resize(n);
+    s.resize(with_s ? n : 0);
+  }
+
+  /// @brief Makes the matrices views on the ones stored one after the
+  /// other at data (see qap_matrix::attach()).
+  void attach(T* data, unsigned int n, bool with_s)
+  {
+    const unsigned int size = qap_matrix<T>::stride_for(n) * n;
+    a.attach(data, n);
+    b.attach(data + size, n);
+    at.attach(data + 2 * size, n);
+    bt.attach(data + 3 * size, n);
+    if(with_s)
+      s.attach(data + 4 * size, n);
+  }
+
+  /// @brief The number of matrices (4 or 5, with s).
+  unsigned int count() const { return s.size() ? 5 : 4; }
+
+  qap_matrix<T> a;
+  qap_matrix<T> b;
+  qap_matrix<T> at;
+  qap_matrix<T> bt;
+  qap_matrix<T> s;
+};
+
+/// @brief The data of a QAP instance.
+///
+/// The matrices are stored as int or, when the values are small
+/// enough, as int16_t (see finalize()): the narrow storage halves the
+/// memory traffic of the evaluation kernels and lets them work on 32
+/// bit lanes only. The code reading the matrices is a template on the
+/// element type and dispatches on narrow().
+///
+/// Once loaded an instance is never modified and is shared, through a
+/// qap_instance_ptr, by all the solutions of the same problem: copying
+/// a solution only copies the permutation and the cost.
+class qap_instance
+{
+public:
+  qap_instance()
+    : wide_m(), narrow_m(), narrow_flag_m(false),
+      symmetry_m(qap_asymmetric), storage_m() { }
+  explicit qap_instance(unsigned int n)
+    : wide_m(), narrow_m(), narrow_flag_m(false),
+      symmetry_m(qap_asymmetric), storage_m()
+  { wide_m.a.resize(n); wide_m.b.resize(n); }
+
+  unsigned int size() const
+  { return narrow_flag_m ? narrow_m.a.size() : wide_m.a.size(); }
+
+  /// @brief The flow matrix, to be filled before finalize().
+  qap_matrix<int>& a() { return wide_m.a; }
+  /// @brief The distance matrix, to be filled before finalize().
+  qap_matrix<int>& b() { return wide_m.b; }
+
+  /// @brief True when the matrices are stored as int16_t.
+  bool narrow() const { return narrow_flag_m; }
+
+  /// @brief Which matrices are symmetric.
+  qap_symmetry symmetry() const { return symmetry_m; }
+
+  /// @brief The matrices, T must be int16_t when narrow() and int
+  /// otherwise.
+  template<typename T>
+  const qap_data<T>& data() const;
+
+  /// @brief Element (i, j) of the flow matrix, whatever the storage.
+  int flow(unsigned int i, unsigned int j) const
+  { return narrow_flag_m ? narrow_m.a(i, j) : wide_m.a(i, j); }
+
+  /// @brief Element (i, j) of the distance matrix, whatever the
+  /// storage.
+  int distance(unsigned int i, unsigned int j) const
+  { return narrow_flag_m ? narrow_m.b(i, j) : wide_m.b(i, j); }
+
+  /// @brief To be called once a() and b() have been filled: computes
+  /// the transposed matrices, detects the symmetric ones and chooses
+  /// the storage.
+  ///
+  /// When a is symmetric (and b is not) the two products of the swap
+  /// delta of each k collapse into one, against s = b + bt; likewise
+  /// with s = a + at when only b is symmetric, and against b itself
+  /// when both are (see qap_model::symmetric_swap_delta()). The
+  /// symmetry is not exploited if s would overflow.
+  ///
+  /// The narrow storage is used (unless allow_narrow is false) when
+  /// all the values, those of s included, fit in an int16_t and the
+  /// vector kernels can accumulate in 32 bit lanes: a swap kernel
+  /// adds, for each of the n columns, two products of differences,
+  /// each at most 4 max|a| max|b| in absolute value, so 8 n max|a|
+  /// max|b| must be below 2^31.
+  void finalize(bool allow_narrow = true)
+  {
+    const unsigned int n = wide_m.a.size();
+    wide_m.at.resize(n);
+    wide_m.bt.resize(n);
+    int max_a = 0, max_b = 0;
+    bool a_symmetric = true, b_symmetric = true;
+    for(unsigned int ii = 0; ii != n; ++ii)
+      for(unsigned int jj = 0; jj != n; ++jj)
+	{
+	  wide_m.at(jj, ii) = wide_m.a(ii, jj);
+	  wide_m.bt(jj, ii) = wide_m.b(ii, jj);
+	  a_symmetric = a_symmetric && wide_m.a(ii, jj) == wide_m.a(jj, ii);
+	  b_symmetric = b_symmetric && wide_m.b(ii, jj) == wide_m.b(jj, ii);
+	  max_a = std::max(max_a, std::max(wide_m.a(ii, jj), -wide_m.a(ii, jj)));
+	  max_b = std::max(max_b, std::max(wide_m.b(ii, jj), -wide_m.b(ii, jj)));
+	}
+
+    const int max_int = std::numeric_limits<int>::max();
+    symmetry_m = qap_asymmetric;
+    int max_s = 0;
+    if(a_symmetric && b_symmetric)
+      symmetry_m = qap_both_symmetric;
+    else if(a_symmetric && max_b <= max_int / 2)
+      symmetry_m = qap_a_symmetric, max_s = 2 * max_b;
+    else if(b_symmetric && max_a <= max_int / 2)
+      symmetry_m = qap_b_symmetric, max_s = 2 * max_a;
+    if(symmetry_m == qap_a_symmetric || symmetry_m == qap_b_symmetric)
+      {
+	const qap_matrix<int>& m = a_symmetric ? wide_m.b : wide_m.a;
+	const qap_matrix<int>& mt = a_symmetric ? wide_m.bt : wide_m.at;
+	wide_m.s.resize(n);
+	for(unsigned int ii = 0; ii != n; ++ii)
+	  for(unsigned int jj = 0; jj != n; ++jj)
+	    wide_m.s(ii, jj) = m(ii, jj) + mt(ii, jj);
+      }
+
+    const int narrow_max = std::numeric_limits<int16_t>::max();
+    narrow_flag_m = allow_narrow && n
+      && max_a <= narrow_max && max_b <= narrow_max && max_s <= narrow_max
+      && 8.0 * n * max_a * max_b < 2147483648.0;
+    if(!narrow_flag_m)
+      return;
+    narrow_m.resize(n, wide_m.s.size() != 0);
+    qap_matrix<int>* from[] = { &wide_m.a, &wide_m.b, &wide_m.at,
+				&wide_m.bt, &wide_m.s };
+    qap_matrix<int16_t>* to[] = { &narrow_m.a, &narrow_m.b, &narrow_m.at,
+				  &narrow_m.bt, &narrow_m.s };
+    for(unsigned int mm = 0; mm != wide_m.count(); ++mm)
+      for(unsigned int ii = 0; ii != n; ++ii)
+	std::copy(from[mm]->row(ii), from[mm]->row(ii) + n, to[mm]->row(ii));
+    wide_m.resize(0, false);
+  }
+
+  /// @brief Makes the instance a view on the a, b, at, bt (and, if
+  /// symmetry calls for it, s) matrices stored one after the other at
+  /// data, as int16_t when narrow is true and as int otherwise; storage
+  /// is kept alive as long as the instance.
+  void attach(const std::tr1::shared_ptr<const void>& storage,
+	      void* data, unsigned int n, bool narrow, qap_symmetry symmetry)
+  {
+    const bool with_s = symmetry == qap_a_symmetric
+      || symmetry == qap_b_symmetric;
+    if(narrow)
+      narrow_m.attach(static_cast<int16_t*>(data), n, with_s);
+    else
+      wide_m.attach(static_cast<int*>(data), n, with_s);
+    narrow_flag_m = narrow;
+    symmetry_m = symmetry;
+    storage_m = storage;
+  }
+
+private:
+  qap_instance(const qap_instance&);
+  qap_instance& operator=(const qap_instance&);
+
+  qap_data<int> wide_m;
+  qap_data<int16_t> narrow_m;
+  bool narrow_flag_m;
+  qap_symmetry symmetry_m;
+  std::tr1::shared_ptr<const void> storage_m;
+};
+
+template<>
+inline const qap_data<int>&
+qap_instance::data<int>() const
+{ return wide_m; }
+
+template<>
+inline const qap_data<int16_t>&
+qap_instance::data<int16_t>() const
+{ return narrow_m; }
+
+typedef std::tr1::shared_ptr<const qap_instance> qap_instance_ptr;
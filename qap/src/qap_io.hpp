@@ -0,0 +1,297 @@
+#pragma once
+
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "qap_instance.hpp"
+
+/// @brief A read only memory mapping of a whole file.
+class qap_mapped_file
+{
+public:
+  explicit qap_mapped_file(const std::string& filename,
+			   int advice = MADV_SEQUENTIAL)
+    : data_m(0), size_m(0)
+  {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if(fd == -1)
+      throw std::runtime_error("Cannot open " + filename);
+    struct stat st;
+    if(::fstat(fd, &st) == -1)
+      {
+	::close(fd);
+	throw std::runtime_error("Cannot stat " + filename);
+      }
+    size_m = st.st_size;
+    if(size_m)
+      {
+	void* p = ::mmap(0, size_m, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(p == MAP_FAILED)
+	  {
+	    ::close(fd);
+	    throw std::runtime_error("Cannot map " + filename);
+	  }
+	data_m = static_cast<const char*>(p);
+	::madvise(p, size_m, advice);
+      }
+    ::close(fd);
+  }
+
+  ~qap_mapped_file()
+  {
+    if(data_m)
+      ::munmap(const_cast<char*>(data_m), size_m);
+  }
+
+  const char* begin() const { return data_m; }
+  const char* end() const { return data_m + size_m; }
+  size_t size() const { return size_m; }
+
+private:
+  qap_mapped_file(const qap_mapped_file&);
+  qap_mapped_file& operator=(const qap_mapped_file&);
+
+  const char* data_m;
+  size_t size_m;
+};
+
+/// @brief Reads the next (optionally signed) decimal integer in [p,
+/// end), skipping the leading white space.
+///
+/// On success p is moved past the number and true is returned.
+inline bool
+qap_parse_int(const char*& p, const char* end, int& value)
+{
+  while(p != end && (*p == ' ' || *p == '\n' || *p == '\r'
+		     || *p == '\t' || *p == '\f' || *p == '\v'))
+    ++p;
+  if(p == end)
+    return false;
+  bool negative = false;
+  if(*p == '-' || *p == '+')
+    negative = (*p++ == '-');
+  if(p == end || *p < '0' || *p > '9')
+    return false;
+  int v = 0;
+  while(p != end && *p >= '0' && *p <= '9')
+    v = v * 10 + (*p++ - '0');
+  value = negative ? -v : v;
+  return true;
+}
+
+/// @brief Parses a QAPLIB instance (n, then the n x n flow and the n x
+/// n distance matrices, white space separated) from [p, end).
+///
+/// The integers are parsed straight into the matrices of the
+/// instance, which is several times faster than the formatted stream
+/// extraction of operator>>(std::istream&, qap_model&).
+inline qap_instance_ptr
+qap_parse_dat(const char* p, const char* end, const std::string& filename)
+{
+  int n;
+  if(!qap_parse_int(p, end, n) || n <= 0)
+    throw std::runtime_error("Bad problem size in " + filename);
+  qap_instance* instance = new qap_instance(n);
+  qap_instance_ptr result(instance);
+  for(int mm = 0; mm != 2; ++mm)
+    {
+      qap_matrix<int>& m = mm ? instance->b() : instance->a();
+      for(int ii = 0; ii != n; ++ii)
+	{
+	  int* row = m.row(ii);
+	  for(int jj = 0; jj != n; ++jj)
+	    if(!qap_parse_int(p, end, row[jj]))
+	      throw std::runtime_error("Truncated matrix in " + filename);
+	}
+    }
+  instance->finalize();
+  return result;
+}
+
+/// @brief Loads a QAPLIB instance, mapping the file in memory.
+inline qap_instance_ptr
+qap_load_dat(const std::string& filename)
+{
+  qap_mapped_file file(filename);
+  return qap_parse_dat(file.begin(), file.end(), filename);
+}
+
+/// @brief A 64 bit FNV-1a hash of [data, data + size), folding eight
+/// bytes at a time.
+inline uint64_t
+qap_checksum(const char* data, size_t size)
+{
+  const uint64_t prime = 1099511628211ULL;
+  uint64_t h = 14695981039346656037ULL;
+  size_t ii = 0;
+  for(; ii + 8 <= size; ii += 8)
+    {
+      uint64_t word;
+      std::memcpy(&word, data + ii, 8);
+      h = (h ^ word) * prime;
+    }
+  for(; ii != size; ++ii)
+    h = (h ^ static_cast<unsigned char>(data[ii])) * prime;
+  return h ^ size;
+}
+
+/// @brief The header of a binary instance cache.
+///
+/// It is followed by the a, b, at, bt and, if any, s matrices (see
+/// qap_data), exactly as they are laid out in memory by qap_matrix
+/// (padded rows), so that the whole file can be mapped and used
+/// without any copy.
+struct qap_cache_header
+{
+  enum { byte_order_mark = 0x01020304, format_version = 1 };
+
+  char magic[8];		// "QAPCACHE"
+  uint32_t byte_order;		// byte_order_mark, as written
+  uint32_t width;		// size of a matrix element (2 or 4)
+  uint32_t n;
+  uint32_t stride;		// elements per (padded) row
+  uint64_t source_size;		// size of the .dat file
+  uint64_t checksum;		// qap_checksum() of the .dat file
+  uint32_t symmetry;		// a qap_symmetry
+  uint32_t version;		// format_version
+  char padding[16];		// the matrices start on a cache line
+};
+
+// Writes the matrices of q, padded rows included.
+template<typename T>
+bool
+qap_write_matrices(FILE* out, const qap_data<T>& q)
+{
+  const qap_matrix<T>* m[] = { &q.a, &q.b, &q.at, &q.bt, &q.s };
+  const size_t bytes = sizeof(T) * size_t(q.a.stride()) * q.a.size();
+  for(unsigned int mm = 0; mm != q.count(); ++mm)
+    if(std::fwrite(m[mm]->row(0), bytes, 1, out) != 1)
+      return false;
+  return true;
+}
+
+/// @brief Writes the cache of an instance, atomically replacing any
+/// previous one. Returns false if the cache could not be written.
+inline bool
+qap_write_cache(const std::string& cachename, const qap_instance& instance,
+		uint64_t source_size, uint64_t checksum)
+{
+  qap_cache_header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, "QAPCACHE", 8);
+  header.byte_order = qap_cache_header::byte_order_mark;
+  header.n = instance.size();
+  if(instance.narrow())
+    {
+      header.width = sizeof(int16_t);
+      header.stride = qap_matrix<int16_t>::stride_for(header.n);
+    }
+  else
+    {
+      header.width = sizeof(int);
+      header.stride = qap_matrix<int>::stride_for(header.n);
+    }
+  header.source_size = source_size;
+  header.checksum = checksum;
+  header.symmetry = instance.symmetry();
+  header.version = qap_cache_header::format_version;
+
+  // write to a temporary file, then rename it: concurrent runs never
+  // see a partial cache
+  std::string tmpname = cachename + ".XXXXXX";
+  int fd = ::mkstemp(&tmpname[0]);
+  if(fd == -1)
+    return false;
+  ::fchmod(fd, 0644);
+  FILE* out = ::fdopen(fd, "wb");
+  if(!out)
+    {
+      ::close(fd);
+      ::unlink(tmpname.c_str());
+      return false;
+    }
+  bool ok = std::fwrite(&header, sizeof(header), 1, out) == 1
+    && (instance.narrow()
+	? qap_write_matrices(out, instance.data<int16_t>())
+	: qap_write_matrices(out, instance.data<int>()));
+  ok = (std::fclose(out) == 0) && ok;
+  if(ok)
+    ok = ::rename(tmpname.c_str(), cachename.c_str()) == 0;
+  if(!ok)
+    ::unlink(tmpname.c_str());
+  return ok;
+}
+
+/// @brief Maps a binary cache, returns a null pointer if there is no
+/// cache or if it does not match the source (size and checksum).
+inline qap_instance_ptr
+qap_read_cache(const std::string& cachename,
+	       uint64_t source_size, uint64_t checksum)
+{
+  std::tr1::shared_ptr<qap_mapped_file> file;
+  try
+    {
+      file.reset(new qap_mapped_file(cachename, MADV_WILLNEED));
+    }
+  catch(std::runtime_error&)
+    {
+      return qap_instance_ptr();
+    }
+  qap_cache_header header;
+  if(file->size() < sizeof(header))
+    return qap_instance_ptr();
+  std::memcpy(&header, file->begin(), sizeof(header));
+  const bool narrow = header.width == sizeof(int16_t);
+  const size_t bytes = size_t(header.width) * header.stride * header.n;
+  const size_t count = (header.symmetry == qap_a_symmetric
+			|| header.symmetry == qap_b_symmetric) ? 5 : 4;
+  if(std::memcmp(header.magic, "QAPCACHE", 8)
+     || header.byte_order != qap_cache_header::byte_order_mark
+     || header.version != qap_cache_header::format_version
+     || (header.width != sizeof(int) && !narrow)
+     || header.n == 0
+     || header.stride != (narrow ? qap_matrix<int16_t>::stride_for(header.n)
+			  : qap_matrix<int>::stride_for(header.n))
+     || header.source_size != source_size
+     || header.checksum != checksum
+     || header.symmetry > qap_both_symmetric
+     || file->size() != sizeof(header) + count * bytes)
+    return qap_instance_ptr();
+  qap_instance* instance = new qap_instance();
+  qap_instance_ptr result(instance);
+  // the mapping is read only: the instance is never modified
+  instance->attach(file, const_cast<char*>(file->begin()) + sizeof(header),
+		   header.n, narrow, qap_symmetry(header.symmetry));
+  return result;
+}
+
+/// @brief Loads a QAPLIB instance through a binary cache kept next to
+/// the file (filename + ".cache").
+///
+/// When the cache exists and matches the checksum of the file the
+/// matrices are used straight from the mapped cache, otherwise the
+/// file is parsed and the cache (re)written. Failing to write the
+/// cache (e.g. in a read only directory) is not an error.
+inline qap_instance_ptr
+qap_load_cached(const std::string& filename)
+{
+  qap_mapped_file source(filename);
+  const uint64_t checksum = qap_checksum(source.begin(), source.size());
+  const std::string cachename = filename + ".cache";
+  qap_instance_ptr instance =
+    qap_read_cache(cachename, source.size(), checksum);
+  if(!instance)
+    {
+      instance = qap_parse_dat(source.begin(), source.end(), filename);
+      qap_write_cache(cachename, *instance, source.size(), checksum);
+    }
+  return instance;
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdint.h>
+#include <tr1/random>
+#include <metslib/mets.hh>
+
+#include "qap_model.hpp"
+#include "qap_its.hpp"
+
+/// @brief The tenure and perturbation ranges of an island.
+///
+/// Island k of K scales the tenure range of the iterated tabu search,
+/// [7, 7n], by 2^(2k/(K-1) - 1), from 1/2 to 2, and the number of
+/// random swaps of a perturbation, [7, max(7, n/2)], the other way
+/// round: the islands with short tenures make the strongest
+/// perturbations. With a single island the ranges are the ones of
+/// itsqap.
+struct qap_island_ranges
+{
+  qap_island_ranges(unsigned int n, unsigned int island,
+		    unsigned int islands)
+    : tenure_min(7), tenure_max(7*n), swaps_min(7),
+      swaps_max(std::max(7, int(n / 2)))
+  {
+    if(islands < 2)
+      return;
+    const double x = 2.0 * island / (islands - 1) - 1.0;
+    const double t = std::pow(2.0, x);
+    const double p = std::pow(2.0, -x);
+    tenure_min = std::max(1, int(7 * t));
+    tenure_max = std::max(tenure_min, int(7 * n * t));
+    swaps_min = std::max(2, int(7 * p));
+    swaps_max = std::max(swaps_min, std::min(int(n), int(n / 2 * p)));
+    swaps_min = std::min(swaps_min, swaps_max);
+  }
+
+  int tenure_min;
+  int tenure_max;
+  int swaps_min;
+  int swaps_max;
+};
+
+/// @brief Lock free mailboxes for the elite solutions of islands.
+///
+/// Each island owns a mailbox, only written by the island. A post
+/// copies the permutation and the cost between two increments of the
+/// sequence number of the box (a sequence lock): the writer never
+/// waits, and a reader retries its copy if the sequence was odd or
+/// has changed meanwhile. Boxes are padded to their own cache lines.
+class qap_elite_mailbox
+{
+public:
+  qap_elite_mailbox(unsigned int islands, unsigned int n)
+    : boxes_m(islands)
+  {
+    for(unsigned int ii = 0; ii != islands; ++ii)
+      boxes_m[ii] = new box(n);
+  }
+
+  ~qap_elite_mailbox()
+  {
+    for(unsigned int ii = 0; ii != boxes_m.size(); ++ii)
+      delete boxes_m[ii];
+  }
+
+  unsigned int islands() const
+  { return boxes_m.size(); }
+
+  /// @brief Posts the elite solution of an island, if it is better
+  /// than the one posted last.
+  void
+  post(unsigned int island, const qap_model& elite)
+  {
+    box& b = *boxes_m[island];
+    const int64_t cost = int64_t(elite.cost_function());
+    if(cost >= b.cost)
+      return;
+    b.sequence = b.sequence + 1;
+    __sync_synchronize();
+    b.cost = cost;
+    std::copy(elite.permutation().begin(), elite.permutation().end(),
+	      b.pi.begin());
+    __sync_synchronize();
+    b.sequence = b.sequence + 1;
+  }
+
+  /// @brief Copies the elite solution posted by an island to pi, if it
+  /// costs less than below. Returns false otherwise.
+  bool
+  fetch(unsigned int island, int64_t below, std::vector<int>& pi) const
+  {
+    const box& b = *boxes_m[island];
+    for(;;)
+      {
+	const unsigned long sequence = b.sequence;
+	__sync_synchronize();
+	if(sequence & 1)
+	  continue;
+	const int64_t cost = b.cost;
+	if(cost < below)
+	  std::copy(b.pi.begin(), b.pi.end(), pi.begin());
+	__sync_synchronize();
+	if(b.sequence == sequence)
+	  return cost < below;
+      }
+  }
+
+private:
+  qap_elite_mailbox(const qap_elite_mailbox&);
+  qap_elite_mailbox& operator=(const qap_elite_mailbox&);
+
+  struct box
+  {
+    explicit box(unsigned int n)
+      : sequence(0), cost(std::numeric_limits<int64_t>::max()), pi(n)
+    { }
+
+    char before[64];
+    volatile unsigned long sequence;
+    volatile int64_t cost;
+    std::vector<int> pi;
+    char after[64];
+  };
+
+  std::vector<box*> boxes_m;
+};
+
+/// @brief Migrates elite solutions between the islands of a ring,
+/// every migration minor iterations of an island.
+///
+/// The island posts the best solution of its start, then fetches the
+/// one posted by the previous island of the ring: if it is better,
+/// it becomes the best solution of the start and the next minor
+/// iteration starts from a perturbation of it (which also counts as
+/// an improvement for the no improvement criterion of the minor
+/// iterations). The next observer, if any, is notified afterwards.
+class qap_migration_observer : public qap_its_observer
+{
+public:
+  qap_migration_observer(qap_elite_mailbox& mailbox, unsigned int island,
+			 unsigned int migration, qap_model& working,
+			 qap_model& best, std::tr1::mt19937& rng,
+			 std::tr1::uniform_int<int>& psg,
+			 qap_its_observer* next = 0)
+    : mailbox_m(mailbox), island_m(island),
+      migration_m(std::max(1u, migration)), working_m(working),
+      best_m(best), rng_m(rng), psg_m(psg), next_m(next),
+      immigrant_m(best.size()), count_m(0), immigrants_m(0)
+  { }
+
+  void
+  minor_iteration_done(const qap_its_progress& progress)
+  {
+    if(++count_m % migration_m == 0 && mailbox_m.islands() > 1)
+      {
+	const unsigned int islands = mailbox_m.islands();
+	mailbox_m.post(island_m, best_m);
+	if(mailbox_m.fetch((island_m + islands - 1) % islands,
+			   int64_t(best_m.cost_function()), immigrant_m))
+	  {
+	    best_m.permutation(immigrant_m);
+	    working_m.permutation(immigrant_m);
+	    mets::perturbate(working_m, psg_m(rng_m), rng_m);
+	    ++immigrants_m;
+	  }
+      }
+    if(next_m)
+      next_m->minor_iteration_done(progress);
+  }
+
+  /// @brief The elite solutions adopted by the island.
+  unsigned int immigrants() const
+  { return immigrants_m; }
+
+private:
+  qap_migration_observer(const qap_migration_observer&);
+  qap_migration_observer& operator=(const qap_migration_observer&);
+
+protected:
+  qap_elite_mailbox& mailbox_m;
+  unsigned int island_m;
+  unsigned int migration_m;
+  qap_model& working_m;
+  qap_model& best_m;
+  std::tr1::mt19937& rng_m;
+  std::tr1::uniform_int<int>& psg_m;
+  qap_its_observer* next_m;
+  std::vector<int> immigrant_m;
+  unsigned int count_m;
+  unsigned int immigrants_m;
+};
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <ostream>
+#include <cmath>
+#include <limits>
+#include <tr1/random>
+#include <pthread.h>
+#include <metslib/mets.hh>
+
+#include "qap_model.hpp"
+#include "qap_termination.hpp"
+
+/// @brief Where a start of the iterated tabu search is, between two
+/// of its minor iterations.
+///
+/// Minor iterations are made until max_noimprove of them in a row
+/// have not improved the best solution of the start.
+struct qap_its_progress
+{
+  enum { max_noimprove = 100 };
+
+  qap_its_progress()
+    : best(std::numeric_limits<mets::gol_type>::max()), left(max_noimprove)
+  { }
+
+  mets::gol_type best;		// best cost of the start seen so far
+  unsigned int left;		// minor iterations left without improvement
+};
+
+/// @brief The iterated tabu search of itsqap, as set up by itsqap
+/// and by qapbench, which must measure the same search (the tenure
+/// and perturbation ranges are those of qap_island_ranges).
+struct qap_its_settings
+{
+  /// @brief The starts made for n facilities, sqrt(n).
+  static unsigned int starts(unsigned int n)
+  { return (unsigned int)std::sqrt(double(n)); }
+
+  /// @brief The swaps sampled at each move by the default
+  /// neighborhood, 12 n.
+  static unsigned int sampled_swaps(unsigned int n)
+  { return 12 * n; }
+};
+
+/// @brief Sets a new start up: rng seeded with seed, the working
+/// solution a random shuffle of initial (not of the permutation left
+/// by the previous start), the best solution of the start a copy of
+/// it and the tenure of the tabu list drawn with tlg.
+template<typename tabu_list_type>
+void
+qap_its_start(qap_model& problem_instance, const qap_model& initial,
+	      qap_model& majorit_solution, tabu_list_type& tabu_list,
+	      std::tr1::mt19937& rng, unsigned long seed,
+	      std::tr1::uniform_int<int>& tlg)
+{
+  rng.seed(seed);
+  problem_instance.permutation(initial.permutation());
+  mets::random_shuffle(problem_instance, rng);
+  majorit_solution.copy_from(problem_instance);
+  tabu_list.tenure(tlg(rng));
+}
+
+/// @brief Notified by qap_minor_iterations() after each minor
+/// iteration, once the next starting point has been drawn.
+class qap_its_observer
+{
+public:
+  virtual ~qap_its_observer() { }
+
+  virtual void
+  minor_iteration_done(const qap_its_progress& progress) = 0;
+};
+
+/// @brief Makes swaps random swaps of two positions of model, drawn
+/// as mets::perturbate() draws them, polling the stop latch, if any,
+/// before each one: a perturbation does not overrun the deadline of
+/// the run. Returns false if it was cut short.
+inline bool
+qap_perturbate(qap_model& model, unsigned int swaps,
+	       std::tr1::mt19937& rng, qap_stop_latch* stop = 0)
+{
+  std::tr1::uniform_int<> int_range;
+  const int n = model.size();
+  for(unsigned int ii = 0; ii != swaps; ++ii)
+    {
+      if(stop && stop->poll())
+	return false;
+      const int p1 = int_range(rng, n);
+      int p2 = int_range(rng, n);
+      while(p1 == p2)
+	p2 = int_range(rng, n);
+      model.apply_swap(p1, p2);
+    }
+  return true;
+}
+
+/// @brief The minor iterations of one start of the iterated tabu
+/// search: tabu searches with a random tenure, each one starting from
+/// a perturbation of the best solution of the major iteration.
+///
+/// The best solution of each minor iteration is recorded in
+/// minorit_solution, a buffer owned by the caller and reused by all
+/// the minor iterations (and starts): the solutions only exchange
+/// their permutation and cost (qap_model::copy_from()), and the
+/// recorder, the termination criteria and the search are set up once.
+/// Once the search is running no heap allocation is made here, only
+/// the tabu list may allocate.
+///
+/// The optional stop latch (chained to e.g. a deadline, see
+/// qap_termination.hpp) is checked by each tabu search, and its
+/// deadline is polled before each search and each perturbation swap:
+/// once it has stopped no further minor iteration is made.
+///
+/// The listener, if any, is attached to each tabu search.
+///
+/// The progress of the start is read from and kept in progress, if
+/// given, so that a start saved between two minor iterations (with
+/// the working solution, the best solution of the start, the tabu
+/// list and the random number generator) can be resumed where it
+/// was.
+/// The observer, if any, is notified after each whole minor iteration.
+///
+/// If os is shared with other threads, os_mutex (if given) is held
+/// while a line is written to it.
+///
+/// Returns the number of minor iterations.
+template<typename neighborhood_t, typename tabu_list_type>
+unsigned int
+qap_minor_iterations(qap_model& problem_instance,
+		     mets::best_ever_solution& majorit_recorder,
+		     qap_model& minorit_solution,
+		     neighborhood_t& neighborhood,
+		     tabu_list_type& tabu_list,
+		     mets::aspiration_criteria_chain& aspiration_criteria,
+		     mets::search_listener<neighborhood_t>* listener,
+		     std::ostream& os,
+		     std::tr1::mt19937& rng,
+		     std::tr1::uniform_int<int>& tlg,
+		     std::tr1::uniform_int<int>& psg,
+		     qap_stop_latch* stop = 0,
+		     qap_its_progress* progress = 0,
+		     qap_its_observer* observer = 0,
+		     pthread_mutex_t* os_mutex = 0)
+{
+  // Do minor iterations with a max no-improve criterion
+  qap_its_progress fresh;
+  qap_its_progress& minor_it = progress ? *progress : fresh;
+
+  // best solution of the minor iteration
+  mets::best_ever_solution minorit_recorder(minorit_solution);
+
+  // fixed number of non improving moves before termination
+  mets::noimprove_termination_criteria
+    termination_criteria(200, stop);
+
+  // the search algorithm
+  mets::tabu_search<neighborhood_t> algorithm(problem_instance,
+					      minorit_recorder,
+					      neighborhood,
+					      tabu_list,
+					      aspiration_criteria,
+					      termination_criteria);
+  if(listener)
+    algorithm.attach(*listener);
+
+  unsigned int minor_iterations = 0;
+  while(!(stop && stop->poll()))
+    {
+      const mets::gol_type best =
+	dynamic_cast<const mets::evaluable_solution&>
+	(majorit_recorder.best_seen()).cost_function();
+      if(best < minor_it.best - mets::epsilon)
+	{
+	  minor_it.best = best;
+	  minor_it.left = qap_its_progress::max_noimprove;
+	}
+      if(!minor_it.left)
+	break;
+      --minor_it.left;
+
+      minorit_solution.copy_from(problem_instance);
+      termination_criteria.reset();
+
+      // random tabu list tenure
+      tabu_list.tenure(tlg(rng));
+
+      if(os_mutex)
+	pthread_mutex_lock(os_mutex);
+      os << "New iteration with tenure: "
+	 << tabu_list.tenure() << std::endl;
+      if(os_mutex)
+	pthread_mutex_unlock(os_mutex);
+
+      // a minor iteration also ends when every move is tabu
+      try
+	{
+	  algorithm.search();
+	}
+      catch(mets::no_moves_error&)
+	{ }
+      ++minor_iterations;
+
+      majorit_recorder.accept(minorit_recorder.best_seen());
+
+      // a stopped search is cut short: the observer is not told about
+      // it, the start is resumed from the end of the last whole minor
+      // iteration and makes the same moves as a run never stopped
+      if(stop && stop->stopped())
+	break;
+
+      problem_instance.copy_from(majorit_recorder.best_seen());
+
+      // perturbate point with random swaps, unless the deadline
+      // passes meanwhile
+      if(!qap_perturbate(problem_instance, psg(rng), rng, stop))
+	break;
+
+      if(observer)
+	observer->minor_iteration_done(minor_it);
+    }
+  return minor_iterations;
+}
@@ -0,0 +1,425 @@
+#pragma once
+
+#include <cstdlib>
+#include <string>
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define QAP_KERNELS_X86 1
+#  include <immintrin.h>
+#endif
+
+/// @file qap_kernels.hpp
+///
+/// Evaluation kernels for the QAP. All of them work on "permuted row
+/// views": a row of the flow matrix (or of its transpose) is read
+/// contiguously, while the matching row of the distance matrix (or of
+/// its transpose) is read through the permutation p, i.e. gathered.
+///
+/// The kernels are templates on the matrix element type: int, or
+/// int16_t for the narrow storage (see qap_instance::finalize()).
+/// Products of int elements are accumulated in 64 bit integers, so
+/// results are exact whatever the instance size; the narrow storage is
+/// only used when the sums fit in 32 bits, and the vector kernels then
+/// accumulate in 32 bit lanes.
+///
+/// Each kernel has a scalar version and, on x86, AVX2 and AVX-512
+/// versions: the best one supported by the running CPU is selected
+/// once, at the first call of qap_kernels<T>::get().
+
+/// @brief Sum over k of
+///
+///   (ai[k] - aj[k]) * (bj[p[k]] - bi[p[k]]) +
+///   (ati[k] - atj[k]) * (btj[p[k]] - bti[p[k]])
+///
+/// that is the swap delta of i and j before the correction of the k =
+/// i and k = j terms.
+template<typename T>
+inline int64_t
+qap_swap_kernel_scalar(const T* ai, const T* aj,
+		       const T* ati, const T* atj,
+		       const T* bi, const T* bj,
+		       const T* bti, const T* btj,
+		       const int* p, unsigned int n)
+{
+  int64_t sum = 0;
+  for(unsigned int k = 0; k != n; ++k)
+    {
+      const int pk = p[k];
+      sum += int64_t(ai[k] - aj[k]) * (bj[pk] - bi[pk]);
+      sum += int64_t(ati[k] - atj[k]) * (btj[pk] - bti[pk]);
+    }
+  return sum;
+}
+
+/// @brief Sum over k of (xi[k] - xj[k]) * (yj[p[k]] - yi[p[k]]).
+///
+/// The swap kernel of instances with a symmetric matrix: see
+/// qap_instance::finalize().
+template<typename T>
+inline int64_t
+qap_symmetric_swap_kernel_scalar(const T* xi, const T* xj,
+				 const T* yi, const T* yj,
+				 const int* p, unsigned int n)
+{
+  int64_t sum = 0;
+  for(unsigned int k = 0; k != n; ++k)
+    sum += int64_t(xi[k] - xj[k]) * (yj[p[k]] - yi[p[k]]);
+  return sum;
+}
+
+/// @brief Sum over k of a[k] * b[p[k]].
+template<typename T>
+inline int64_t
+qap_dot_kernel_scalar(const T* a, const T* b,
+		      const int* p, unsigned int n)
+{
+  int64_t sum = 0;
+  for(unsigned int k = 0; k != n; ++k)
+    sum += int64_t(a[k]) * b[p[k]];
+  return sum;
+}
+
+#if defined(QAP_KERNELS_X86)
+
+// Loads 8 consecutive elements in 32 bit lanes.
+__attribute__((target("avx2"))) inline __m256i
+qap_load_avx2(const int* x)
+{ return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x)); }
+
+__attribute__((target("avx2"))) inline __m256i
+qap_load_avx2(const int16_t* x)
+{
+  return _mm256_cvtepi16_epi32
+    (_mm_loadu_si128(reinterpret_cast<const __m128i*>(x)));
+}
+
+// Gathers x[p[k]] in 32 bit lanes. There is no 16 bit gather: 32 bits
+// are read at x + p[k] and the upper half (the next element, or the
+// row padding) is dropped.
+__attribute__((target("avx2"))) inline __m256i
+qap_gather_avx2(const int* x, __m256i vp)
+{ return _mm256_i32gather_epi32(x, vp, 4); }
+
+__attribute__((target("avx2"))) inline __m256i
+qap_gather_avx2(const int16_t* x, __m256i vp)
+{
+  const __m256i v =
+    _mm256_i32gather_epi32(reinterpret_cast<const int*>(x), vp, 2);
+  return _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+}
+
+// Multiplies the signed 32 bit lanes of x and y and adds the products
+// to acc: in 64 bit lanes (even and odd lanes separately) for int
+// elements, in 32 bit lanes for int16_t ones.
+__attribute__((target("avx2"))) inline __m256i
+qap_madd_avx2(__m256i acc, __m256i x, __m256i y, const int*)
+{
+  acc = _mm256_add_epi64(acc, _mm256_mul_epi32(x, y));
+  return _mm256_add_epi64(acc, _mm256_mul_epi32(_mm256_srli_epi64(x, 32),
+						_mm256_srli_epi64(y, 32)));
+}
+
+__attribute__((target("avx2"))) inline __m256i
+qap_madd_avx2(__m256i acc, __m256i x, __m256i y, const int16_t*)
+{ return _mm256_add_epi32(acc, _mm256_mullo_epi32(x, y)); }
+
+__attribute__((target("avx2"))) inline int64_t
+qap_hsum_avx2(__m256i acc, const int*)
+{
+  int64_t lanes[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("avx2"))) inline int64_t
+qap_hsum_avx2(__m256i acc, const int16_t*)
+{
+  int32_t lanes[8];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+  int64_t sum = 0;
+  for(int ii = 0; ii != 8; ++ii)
+    sum += lanes[ii];
+  return sum;
+}
+
+template<typename T>
+__attribute__((target("avx2"))) inline int64_t
+qap_swap_kernel_avx2(const T* ai, const T* aj,
+		     const T* ati, const T* atj,
+		     const T* bi, const T* bj,
+		     const T* bti, const T* btj,
+		     const int* p, unsigned int n)
+{
+  __m256i acc = _mm256_setzero_si256();
+  unsigned int k = 0;
+  for(; k + 8 <= n; k += 8)
+    {
+      const __m256i vp =
+	_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + k));
+      const __m256i da = _mm256_sub_epi32(qap_load_avx2(ai + k),
+					  qap_load_avx2(aj + k));
+      const __m256i db = _mm256_sub_epi32(qap_gather_avx2(bj, vp),
+					  qap_gather_avx2(bi, vp));
+      const __m256i dat = _mm256_sub_epi32(qap_load_avx2(ati + k),
+					   qap_load_avx2(atj + k));
+      const __m256i dbt = _mm256_sub_epi32(qap_gather_avx2(btj, vp),
+					   qap_gather_avx2(bti, vp));
+      acc = qap_madd_avx2(acc, da, db, ai);
+      acc = qap_madd_avx2(acc, dat, dbt, ai);
+    }
+  return qap_hsum_avx2(acc, ai)
+    + qap_swap_kernel_scalar(ai + k, aj + k, ati + k, atj + k,
+			     bi, bj, bti, btj, p + k, n - k);
+}
+
+template<typename T>
+__attribute__((target("avx2"))) inline int64_t
+qap_symmetric_swap_kernel_avx2(const T* xi, const T* xj,
+			       const T* yi, const T* yj,
+			       const int* p, unsigned int n)
+{
+  __m256i acc = _mm256_setzero_si256();
+  unsigned int k = 0;
+  for(; k + 8 <= n; k += 8)
+    {
+      const __m256i vp =
+	_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + k));
+      const __m256i dx = _mm256_sub_epi32(qap_load_avx2(xi + k),
+					  qap_load_avx2(xj + k));
+      const __m256i dy = _mm256_sub_epi32(qap_gather_avx2(yj, vp),
+					  qap_gather_avx2(yi, vp));
+      acc = qap_madd_avx2(acc, dx, dy, xi);
+    }
+  return qap_hsum_avx2(acc, xi)
+    + qap_symmetric_swap_kernel_scalar(xi + k, xj + k, yi, yj, p + k, n - k);
+}
+
+template<typename T>
+__attribute__((target("avx2"))) inline int64_t
+qap_dot_kernel_avx2(const T* a, const T* b,
+		    const int* p, unsigned int n)
+{
+  __m256i acc = _mm256_setzero_si256();
+  unsigned int k = 0;
+  for(; k + 8 <= n; k += 8)
+    {
+      const __m256i vp =
+	_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + k));
+      acc = qap_madd_avx2(acc, qap_load_avx2(a + k),
+			  qap_gather_avx2(b, vp), a);
+    }
+  return qap_hsum_avx2(acc, a)
+    + qap_dot_kernel_scalar(a + k, b, p + k, n - k);
+}
+
+// The AVX-512 versions of the helpers above, on 16 lanes. The plain
+// forms of the gathers, shifts, multiplies and conversions pass an
+// undefined vector as the merge source of their masked builtins,
+// which GCC 12 reports as maybe uninitialized at -O3: the zero masked
+// forms, with every lane selected, are used instead, and the sums are
+// made from a store as in the AVX2 helpers.
+__attribute__((target("avx512f"))) inline __m512i
+qap_load_avx512(const int* x)
+{ return _mm512_loadu_si512(x); }
+
+__attribute__((target("avx512f"))) inline __m512i
+qap_load_avx512(const int16_t* x)
+{
+  return _mm512_maskz_cvtepi16_epi32
+    (0xFFFF, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x)));
+}
+
+__attribute__((target("avx512f"))) inline __m512i
+qap_gather_avx512(const int* x, __m512i vp)
+{
+  return _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), 0xFFFF,
+				     vp, x, 4);
+}
+
+__attribute__((target("avx512f"))) inline __m512i
+qap_gather_avx512(const int16_t* x, __m512i vp)
+{
+  const __m512i v = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(),
+						0xFFFF, vp, x, 2);
+  return _mm512_maskz_srai_epi32(0xFFFF,
+				 _mm512_maskz_slli_epi32(0xFFFF, v, 16), 16);
+}
+
+__attribute__((target("avx512f"))) inline __m512i
+qap_madd_avx512(__m512i acc, __m512i x, __m512i y, const int*)
+{
+  acc = _mm512_add_epi64(acc, _mm512_maskz_mul_epi32(0xFF, x, y));
+  return _mm512_add_epi64(acc, _mm512_maskz_mul_epi32
+			  (0xFF, _mm512_maskz_srli_epi64(0xFF, x, 32),
+			   _mm512_maskz_srli_epi64(0xFF, y, 32)));
+}
+
+__attribute__((target("avx512f"))) inline __m512i
+qap_madd_avx512(__m512i acc, __m512i x, __m512i y, const int16_t*)
+{ return _mm512_add_epi32(acc, _mm512_mullo_epi32(x, y)); }
+
+__attribute__((target("avx512f"))) inline int64_t
+qap_hsum_avx512(__m512i acc, const int*)
+{
+  int64_t lanes[8];
+  _mm512_storeu_si512(lanes, acc);
+  int64_t sum = 0;
+  for(int ii = 0; ii != 8; ++ii)
+    sum += lanes[ii];
+  return sum;
+}
+
+__attribute__((target("avx512f"))) inline int64_t
+qap_hsum_avx512(__m512i acc, const int16_t*)
+{
+  int32_t lanes[16];
+  _mm512_storeu_si512(lanes, acc);
+  int64_t sum = 0;
+  for(int ii = 0; ii != 16; ++ii)
+    sum += lanes[ii];
+  return sum;
+}
+
+template<typename T>
+__attribute__((target("avx512f"))) inline int64_t
+qap_swap_kernel_avx512(const T* ai, const T* aj,
+		       const T* ati, const T* atj,
+		       const T* bi, const T* bj,
+		       const T* bti, const T* btj,
+		       const int* p, unsigned int n)
+{
+  __m512i acc = _mm512_setzero_si512();
+  unsigned int k = 0;
+  for(; k + 16 <= n; k += 16)
+    {
+      const __m512i vp = _mm512_loadu_si512(p + k);
+      const __m512i da = _mm512_sub_epi32(qap_load_avx512(ai + k),
+					  qap_load_avx512(aj + k));
+      const __m512i db = _mm512_sub_epi32(qap_gather_avx512(bj, vp),
+					  qap_gather_avx512(bi, vp));
+      const __m512i dat = _mm512_sub_epi32(qap_load_avx512(ati + k),
+					   qap_load_avx512(atj + k));
+      const __m512i dbt = _mm512_sub_epi32(qap_gather_avx512(btj, vp),
+					   qap_gather_avx512(bti, vp));
+      acc = qap_madd_avx512(acc, da, db, ai);
+      acc = qap_madd_avx512(acc, dat, dbt, ai);
+    }
+  return qap_hsum_avx512(acc, ai)
+    + qap_swap_kernel_scalar(ai + k, aj + k, ati + k, atj + k,
+			     bi, bj, bti, btj, p + k, n - k);
+}
+
+template<typename T>
+__attribute__((target("avx512f"))) inline int64_t
+qap_symmetric_swap_kernel_avx512(const T* xi, const T* xj,
+				 const T* yi, const T* yj,
+				 const int* p, unsigned int n)
+{
+  __m512i acc = _mm512_setzero_si512();
+  unsigned int k = 0;
+  for(; k + 16 <= n; k += 16)
+    {
+      const __m512i vp = _mm512_loadu_si512(p + k);
+      const __m512i dx = _mm512_sub_epi32(qap_load_avx512(xi + k),
+					  qap_load_avx512(xj + k));
+      const __m512i dy = _mm512_sub_epi32(qap_gather_avx512(yj, vp),
+					  qap_gather_avx512(yi, vp));
+      acc = qap_madd_avx512(acc, dx, dy, xi);
+    }
+  return qap_hsum_avx512(acc, xi)
+    + qap_symmetric_swap_kernel_scalar(xi + k, xj + k, yi, yj, p + k, n - k);
+}
+
+template<typename T>
+__attribute__((target("avx512f"))) inline int64_t
+qap_dot_kernel_avx512(const T* a, const T* b,
+		      const int* p, unsigned int n)
+{
+  __m512i acc = _mm512_setzero_si512();
+  unsigned int k = 0;
+  for(; k + 16 <= n; k += 16)
+    {
+      const __m512i vp = _mm512_loadu_si512(p + k);
+      acc = qap_madd_avx512(acc, qap_load_avx512(a + k),
+			    qap_gather_avx512(b, vp), a);
+    }
+  return qap_hsum_avx512(acc, a)
+    + qap_dot_kernel_scalar(a + k, b, p + k, n - k);
+}
+
+#endif
+
+/// @brief The set of kernels in use for matrices of T.
+///
+/// The selection can be forced setting the QAP_KERNELS environment
+/// variable to "scalar", "avx2" or "avx512" (an unsupported request
+/// falls back to the best available set).
+template<typename T>
+struct qap_kernels
+{
+  /// @brief See qap_swap_kernel_scalar().
+  typedef int64_t (*swap_kernel)(const T* ai, const T* aj,
+				 const T* ati, const T* atj,
+				 const T* bi, const T* bj,
+				 const T* bti, const T* btj,
+				 const int* p, unsigned int n);
+
+  /// @brief See qap_symmetric_swap_kernel_scalar().
+  typedef int64_t (*symmetric_swap_kernel)(const T* xi, const T* xj,
+					   const T* yi, const T* yj,
+					   const int* p, unsigned int n);
+
+  /// @brief See qap_dot_kernel_scalar().
+  typedef int64_t (*dot_kernel)(const T* a, const T* b,
+				const int* p, unsigned int n);
+
+  swap_kernel swap;
+  symmetric_swap_kernel symmetric_swap;
+  dot_kernel dot;
+  const char* name;
+
+  static const qap_kernels&
+  get()
+  {
+    static const qap_kernels selected = select(std::getenv("QAP_KERNELS"));
+    return selected;
+  }
+
+  static qap_kernels
+  scalar()
+  {
+    qap_kernels k = { qap_swap_kernel_scalar<T>,
+		      qap_symmetric_swap_kernel_scalar<T>,
+		      qap_dot_kernel_scalar<T>, "scalar" };
+    return k;
+  }
+
+  /// @brief The best kernels supported by this CPU, or the requested
+  /// ones when supported.
+  static qap_kernels
+  select(const char* request)
+  {
+    const std::string want(request ? request : "");
+    if(want == "scalar")
+      return scalar();
+#if defined(QAP_KERNELS_X86)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f") && want != "avx2")
+      {
+	qap_kernels k = { qap_swap_kernel_avx512<T>,
+			  qap_symmetric_swap_kernel_avx512<T>,
+			  qap_dot_kernel_avx512<T>, "avx512" };
+	return k;
+      }
+    if(__builtin_cpu_supports("avx2"))
+      {
+	qap_kernels k = { qap_swap_kernel_avx2<T>,
+			  qap_symmetric_swap_kernel_avx2<T>,
+			  qap_dot_kernel_avx2<T>, "avx2" };
+	return k;
+      }
+#endif
+    return scalar();
+  }
+};
@@ -3,49 +3,182 @@
 #include <cassert>
 #include <vector>
 #include <algorithm>
+#include <stdint.h>
 #include <metslib/mets.hh>
 
+#include "qap_instance.hpp"
+#include "qap_kernels.hpp"
+
 class qap_model : public mets::permutation_problem
 {
 protected:
-  std::vector< std::vector<int> > a_m;
-  std::vector< std::vector<int> > b_m;
+  /// @brief The shared, immutable, flow and distance matrices.
+  qap_instance_ptr instance_m;
   
+  /// @brief Optional n x n table of swap deltas (only u < v is used).
+  ///
+  /// It is mutable because it is rebuilt by compute_cost(), the only
+  /// hook called by mets::random_shuffle after the permutation has
+  /// been changed wholesale.
+  mutable std::vector<int64_t> delta_m;
+  bool use_delta_m;
+
+  /// @brief Optional n x n table of placement costs: entry u*n+l is
+  /// the cost of the terms of facility u with all the other ones, were
+  /// u at location l and the others where they are.
+  ///
+  /// It is built by the first cycle_delta() made with the delta table
+  /// enabled, then kept up to date with it.
+  mutable std::vector<int64_t> place_m;
+  mutable bool use_place_m;
+
 public:
-  qap_model() : permutation_problem(0), a_m(), b_m() {};
-  
+  qap_model()
+    : permutation_problem(0), instance_m(), delta_m(), use_delta_m(false),
+      place_m(), use_place_m(false)
+  {};
+
+  /// @brief A solution of the given instance (identity permutation).
+  explicit qap_model(const qap_instance_ptr& instance)
+    : permutation_problem(instance->size()), instance_m(instance),
+      delta_m(), use_delta_m(false), place_m(), use_place_m(false)
+  { update_cost(); }
+
+  /// @brief Copy ctor: the delta and placement tables are working
+  /// solution state and are not propagated to copies (e.g. to the
+  /// recorded solutions).
+  qap_model(const qap_model& o)
+    : permutation_problem(o), instance_m(o.instance_m),
+      delta_m(), use_delta_m(false), place_m(), use_place_m(false)
+  {};
+
   void copy_from(const mets::copyable& sol)
   {
     const qap_model& o = dynamic_cast<const qap_model&>(sol);
     permutation_problem::copy_from(sol);
-    a_m = o.a_m;
-    b_m = o.b_m;
+    instance_m = o.instance_m;
+    if(use_delta_m)
+      {
+	if(o.use_delta_m)
+	  delta_m = o.delta_m;
+	else
+	  init_delta_table();
+      }
+    if(use_place_m)
+      {
+	if(o.use_place_m)
+	  place_m = o.place_m;
+	else
+	  init_place_table();
+      }
+  }
+
+  /// @brief Enables or disables the incremental delta table.
+  ///
+  /// When enabled evaluate_swap() is a table lookup and every
+  /// apply_swap(r, s) updates the table: O(1) for each of the pairs
+  /// that do not touch r or s and O(n) for the 2n pairs that do
+  /// (Taillard, "Robust taboo search for the QAP", 1991).
+  void delta_table(bool enable)
+  {
+    use_delta_m = enable;
+    if(use_delta_m)
+      init_delta_table();
+    else
+      {
+	std::vector<int64_t>().swap(delta_m);
+	std::vector<int64_t>().swap(place_m);
+	use_place_m = false;
+      }
   }
 
+  bool delta_table() const
+  { return use_delta_m; }
+
+  /// @brief The location of facility i.
+  int location(int i) const
+  { return pi_m[i]; }
+
+  /// @brief The locations of all the facilities.
+  const std::vector<int>& permutation() const
+  { return pi_m; }
+
+  /// @brief Replaces the permutation (e.g. with a saved one) and
+  /// computes the cost again.
+  void permutation(const std::vector<int>& pi)
+  {
+    assert(pi.size() == pi_m.size());
+    pi_m = pi;
+    update_cost();
+  }
+
+  /// @brief The instance data shared by all the solutions.
+  const qap_instance_ptr& instance() const
+  { return instance_m; }
+
   /// @brief: swap move that does delta updates of the objective.
   ///
   /// This is much faster as it runs in O(n) instead of O(n^2) (it
-  /// takes 8n multiplications instead of n^2 to compute the objective
-  /// function after a swap).
+  /// takes 2n vectorized multiplications instead of n^2 to compute
+  /// the objective function after a swap), or in O(1) when the delta
+  /// table is enabled.
   mets::gol_type
   evaluate_swap(int i, int j) const
+  { return swap_delta(i, j); }
+
+  /// @brief Non virtual version of evaluate_swap(), for the
+  /// neighborhoods scanning many swaps in a tight loop.
+  int64_t
+  swap_delta(int i, int j) const
   {
     assert(i!=j);
-    double delta = 0.0;
-    for(unsigned int ii=0; ii != a_m.size(); ++ii)
+    if(use_delta_m)
+      return delta_m[std::min(i,j)*pi_m.size() + std::max(i,j)];
+    return compute_swap_delta(i, j);
+  }
+
+  /// @brief Applies the swap and keeps the delta table up to date.
+  void
+  apply_swap(int r, int s)
+  {
+    if(!use_delta_m)
       {
-	delta -= a_m[i][ii] * b_m[pi_m[i]][pi_m[ii]];
-	delta -= a_m[ii][i] * b_m[pi_m[ii]][pi_m[i]];
-	delta -= a_m[j][ii] * b_m[pi_m[j]][pi_m[ii]];
-	delta -= a_m[ii][j] * b_m[pi_m[ii]][pi_m[j]];
-	int ni = ii;
-	if(ii==i) ni = j; else if(ii==j) ni = i;
-	delta += a_m[i][ii] * b_m[pi_m[j]][pi_m[ni]];
-	delta += a_m[ii][i] * b_m[pi_m[ni]][pi_m[j]];
-	delta += a_m[j][ii] * b_m[pi_m[i]][pi_m[ni]];
-	delta += a_m[ii][j] * b_m[pi_m[ni]][pi_m[i]];
+	permutation_problem::apply_swap(r, s);
+	return;
       }
-    return delta;
+    cost_m += evaluate_swap(r, s);
+    std::swap(pi_m[r], pi_m[s]);
+    update_delta_table(r, s);
+    if(use_place_m)
+      update_place_table(r, s);
+  }
+
+  /// @brief Exact cost variation of the 3-cycle moving facility i to
+  /// the location of j, j to the location of k and k to the location
+  /// of i (i, j and k distinct).
+  ///
+  /// It is O(n) without the delta table and O(1) with it, from the
+  /// placement table (built here on first use). The swap deltas alone
+  /// do not give it: they only give the sum of the deltas of the cycle
+  /// and of its reverse.
+  int64_t
+  cycle_delta(int i, int j, int k) const
+  {
+    assert(i != j && j != k && k != i);
+    if(use_delta_m && !use_place_m)
+      init_place_table();
+    return instance_m->narrow() ? cycle_delta<int16_t>(i, j, k)
+      : cycle_delta<int>(i, j, k);
+  }
+
+  /// @brief Applies the 3-cycle of cycle_delta(), as the swap of i and
+  /// j followed by the swap of j and k (keeping the delta table up to
+  /// date).
+  void
+  apply_cycle(int i, int j, int k)
+  {
+    apply_swap(i, j);
+    apply_swap(j, k);
   }
 
   friend std::ostream& operator<<(std::ostream& os, const qap_model& p);
@@ -56,13 +189,311 @@ protected:
   // Full cost calculation
   mets::gol_type compute_cost() const
   {
-    double sum = 0.0;
+    if(pi_m.empty())
+      return 0.0;
+    const int64_t sum = instance_m->narrow() ? compute_cost<int16_t>()
+      : compute_cost<int>();
+    if(use_delta_m)
+      init_delta_table();
+    if(use_place_m)
+      init_place_table();
+    return sum;
+  }
+
+  template<typename T>
+  int64_t compute_cost() const
+  {
+    const qap_data<T>& q = instance_m->data<T>();
+    const typename qap_kernels<T>::dot_kernel dot = qap_kernels<T>::get().dot;
+    int64_t sum = 0;
     for(unsigned int ii = 0; ii != pi_m.size(); ++ii)
-      for(unsigned int jj = 0; jj != pi_m.size(); ++jj)
-	sum += (a_m[ii][jj]) * b_m[pi_m[ii]][pi_m[jj]];
+      sum += dot(q.a.row(ii), q.b.row(pi_m[ii]), &pi_m[0], pi_m.size());
     return sum;
   }
 
+  /// @brief Exact O(n) cost variation of swapping i and j.
+  int64_t
+  compute_swap_delta(int i, int j) const
+  {
+    return instance_m->narrow() ? compute_swap_delta<int16_t>(i, j)
+      : compute_swap_delta<int>(i, j);
+  }
+
+  /// @brief Exact O(n) cost variation of swapping i and j, on matrices
+  /// of T.
+  template<typename T>
+  int64_t
+  compute_swap_delta(int i, int j) const
+  {
+    return instance_m->symmetry() == qap_asymmetric
+      ? general_swap_delta<T>(i, j) : symmetric_swap_delta<T>(i, j);
+  }
+
+  /// @brief Exact O(n) cost variation of swapping i and j, two
+  /// products per k.
+  ///
+  /// The terms involving both i and j are accounted once, so that the
+  /// value is exact also for asymmetric matrices with a non constant
+  /// diagonal.
+  template<typename T>
+  int64_t
+  general_swap_delta(int i, int j) const
+  {
+    const qap_data<T>& q = instance_m->data<T>();
+    const int pi = pi_m[i];
+    const int pj = pi_m[j];
+    const T* ai = q.a.row(i);
+    const T* aj = q.a.row(j);
+    const T* ati = q.at.row(i);
+    const T* atj = q.at.row(j);
+    const T* bi = q.b.row(pi);
+    const T* bj = q.b.row(pj);
+    const T* bti = q.bt.row(pi);
+    const T* btj = q.bt.row(pj);
+    int64_t delta = qap_kernels<T>::get().swap(ai, aj, ati, atj,
+					       bi, bj, bti, btj,
+					       &pi_m[0], pi_m.size());
+    // the kernel accounts the k = i and k = j terms as if p[k] did
+    // not change: replace them with the exact ones.
+    delta -= int64_t(ai[i] - aj[i]) * (bj[pi] - bi[pi])
+      + int64_t(ati[i] - atj[i]) * (btj[pi] - bti[pi]);
+    delta -= int64_t(ai[j] - aj[j]) * (bj[pj] - bi[pj])
+      + int64_t(ati[j] - atj[j]) * (btj[pj] - bti[pj]);
+    delta += int64_t(ai[i] - aj[j]) * (bj[pj] - bi[pi])
+      + int64_t(ai[j] - aj[i]) * (bj[pi] - bi[pj]);
+    return delta;
+  }
+
+  /// @brief Same as general_swap_delta(), with one product per k, for
+  /// the instances where a or b is symmetric.
+  ///
+  /// If a is symmetric the two products of general_swap_delta() are
+  /// (ai[k] - aj[k]) * (sj[p[k]] - si[p[k]]) with s = b + bt, if b is
+  /// symmetric they are (si[k] - sj[k]) * (bj[p[k]] - bi[p[k]]) with s
+  /// = a + at, and if both are symmetric they are twice (ai[k] -
+  /// aj[k]) * (bj[p[k]] - bi[p[k]]). The identity holds for every k,
+  /// so the diagonals need not be zero: the k = i and k = j terms are
+  /// corrected exactly as in the general case.
+  template<typename T>
+  int64_t
+  symmetric_swap_delta(int i, int j) const
+  {
+    const qap_data<T>& q = instance_m->data<T>();
+    const qap_symmetry symmetry = instance_m->symmetry();
+    const qap_matrix<T>& x = symmetry == qap_b_symmetric ? q.s : q.a;
+    const qap_matrix<T>& y = symmetry == qap_a_symmetric ? q.s : q.b;
+    const int pi = pi_m[i];
+    const int pj = pi_m[j];
+    const T* xi = x.row(i);
+    const T* xj = x.row(j);
+    const T* yi = y.row(pi);
+    const T* yj = y.row(pj);
+    int64_t delta = qap_kernels<T>::get().symmetric_swap(xi, xj, yi, yj,
+							 &pi_m[0],
+							 pi_m.size());
+    delta -= int64_t(xi[i] - xj[i]) * (yj[pi] - yi[pi])
+      + int64_t(xi[j] - xj[j]) * (yj[pj] - yi[pj]);
+    if(symmetry == qap_both_symmetric)
+      delta *= 2;
+    const T* ai = q.a.row(i);
+    const T* aj = q.a.row(j);
+    const T* bi = q.b.row(pi);
+    const T* bj = q.b.row(pj);
+    delta += int64_t(ai[i] - aj[j]) * (bj[pj] - bi[pi])
+      + int64_t(ai[j] - aj[i]) * (bj[pi] - bi[pj]);
+    return delta;
+  }
+
+  /// @brief Exact cost variation of a 3-cycle, on matrices of T.
+  ///
+  /// Only the terms of the rows and columns of i, j and k change:
+  /// those with a facility v outside the cycle are summed in one pass
+  /// (two products per facility of the cycle), then the ones with v
+  /// in the cycle, which the pass accounts as if v did not move, are
+  /// replaced with the exact ones. With the placement table the pass
+  /// is the difference of two of its entries, which leave out v = u
+  /// itself.
+  template<typename T>
+  int64_t
+  cycle_delta(int i, int j, int k) const
+  {
+    const qap_data<T>& q = instance_m->data<T>();
+    const int n = pi_m.size();
+    const int s[3] = { i, j, k };
+    const int from[3] = { pi_m[i], pi_m[j], pi_m[k] };
+    const int to[3] = { pi_m[j], pi_m[k], pi_m[i] };
+    int64_t delta = 0;
+    for(int tt = 0; tt != 3; ++tt)
+      {
+	const T* a = q.a.row(s[tt]);
+	const T* at = q.at.row(s[tt]);
+	const T* b_to = q.b.row(to[tt]);
+	const T* b_from = q.b.row(from[tt]);
+	const T* bt_to = q.bt.row(to[tt]);
+	const T* bt_from = q.bt.row(from[tt]);
+	if(use_place_m)
+	  delta += place_m[s[tt]*n + to[tt]] - place_m[s[tt]*n + from[tt]];
+	else
+	  for(int vv = 0; vv != n; ++vv)
+	    {
+	      const int pv = pi_m[vv];
+	      delta += int64_t(a[vv]) * (b_to[pv] - b_from[pv])
+		+ int64_t(at[vv]) * (bt_to[pv] - bt_from[pv]);
+	    }
+	for(int uu = 0; uu != 3; ++uu)
+	  {
+	    if(use_place_m && uu == tt)
+	      continue;
+	    const int pv = from[uu];
+	    delta -= int64_t(a[s[uu]]) * (b_to[pv] - b_from[pv])
+	      + int64_t(at[s[uu]]) * (bt_to[pv] - bt_from[pv]);
+	  }
+      }
+    for(int tt = 0; tt != 3; ++tt)
+      {
+	const T* a = q.a.row(s[tt]);
+	for(int uu = 0; uu != 3; ++uu)
+	  delta += int64_t(a[s[uu]])
+	    * (q.b.row(to[tt])[to[uu]] - q.b.row(from[tt])[from[uu]]);
+      }
+    return delta;
+  }
+
+  void init_delta_table() const
+  {
+    const int n = pi_m.size();
+    delta_m.resize(n*n);
+    for(int ii = 0; ii < n; ++ii)
+      for(int jj = ii+1; jj < n; ++jj)
+	delta_m[ii*n+jj] = compute_swap_delta(ii, jj);
+  }
+
+  /// @brief Updates the delta table after r and s have been swapped.
+  void update_delta_table(int r, int s)
+  {
+    if(instance_m->narrow())
+      update_delta_table<int16_t>(r, s);
+    else
+      update_delta_table<int>(r, s);
+  }
+
+  template<typename T>
+  void update_delta_table(int r, int s)
+  {
+    const int n = pi_m.size();
+    const qap_matrix<T>& a = instance_m->data<T>().a;
+    const qap_matrix<T>& b = instance_m->data<T>().b;
+    const T* ar = a.row(r);
+    const T* as = a.row(s);
+    const T* bpr = b.row(pi_m[r]);
+    const T* bps = b.row(pi_m[s]);
+    const int pr = pi_m[r];
+    const int ps = pi_m[s];
+    for(int uu = 0; uu < n; ++uu)
+      {
+	if(uu == r || uu == s)
+	  {
+	    for(int vv = uu+1; vv < n; ++vv)
+	      delta_m[uu*n+vv] = compute_swap_delta<T>(uu, vv);
+	    continue;
+	  }
+	const int pu = pi_m[uu];
+	const T* au = a.row(uu);
+	const T* bpu = b.row(pu);
+	for(int vv = uu+1; vv < n; ++vv)
+	  {
+	    if(vv == r || vv == s)
+	      {
+		delta_m[uu*n+vv] = compute_swap_delta<T>(uu, vv);
+		continue;
+	      }
+	    const int pv = pi_m[vv];
+	    const T* av = a.row(vv);
+	    const T* bpv = b.row(pv);
+	    delta_m[uu*n+vv] +=
+	      int64_t(ar[uu] - ar[vv] + as[vv] - as[uu])
+	      * (bps[pu] - bps[pv] + bpr[pv] - bpr[pu])
+	      + int64_t(au[r] - av[r] + av[s] - au[s])
+	      * (bpu[ps] - bpv[ps] + bpv[pr] - bpu[pr]);
+	  }
+      }
+  }
+
+  void init_place_table() const
+  {
+    if(instance_m->narrow())
+      init_place_table<int16_t>();
+    else
+      init_place_table<int>();
+    use_place_m = true;
+  }
+
+  /// @brief Fills the placement table, two dot products per entry.
+  template<typename T>
+  void init_place_table() const
+  {
+    const qap_data<T>& q = instance_m->data<T>();
+    const typename qap_kernels<T>::dot_kernel dot = qap_kernels<T>::get().dot;
+    const int n = pi_m.size();
+    place_m.resize(n*n);
+    for(int uu = 0; uu < n; ++uu)
+      {
+	const T* au = q.a.row(uu);
+	const T* atu = q.at.row(uu);
+	const int pu = pi_m[uu];
+	for(int ll = 0; ll < n; ++ll)
+	  {
+	    const T* bl = q.b.row(ll);
+	    const T* btl = q.bt.row(ll);
+	    place_m[uu*n+ll] = dot(au, bl, &pi_m[0], n)
+	      + dot(atu, btl, &pi_m[0], n)
+	      - int64_t(au[uu]) * (bl[pu] + btl[pu]);
+	  }
+      }
+  }
+
+  /// @brief Updates the placement table after r and s have been
+  /// swapped: O(1) per entry, as only the terms with r and s change.
+  void update_place_table(int r, int s)
+  {
+    if(instance_m->narrow())
+      update_place_table<int16_t>(r, s);
+    else
+      update_place_table<int>(r, s);
+  }
+
+  template<typename T>
+  void update_place_table(int r, int s)
+  {
+    const qap_data<T>& q = instance_m->data<T>();
+    const int n = pi_m.size();
+    const T* bpr = q.b.row(pi_m[r]);
+    const T* bps = q.b.row(pi_m[s]);
+    const T* btpr = q.bt.row(pi_m[r]);
+    const T* btps = q.bt.row(pi_m[s]);
+    for(int uu = 0; uu < n; ++uu)
+      {
+	const T* au = q.a.row(uu);
+	const T* atu = q.at.row(uu);
+	int64_t ca = au[r] - au[s];
+	int64_t cat = atu[r] - atu[s];
+	// the entries of r and s leave out their own (diagonal) terms
+	if(uu == r)
+	  {
+	    ca -= au[r];
+	    cat -= atu[r];
+	  }
+	else if(uu == s)
+	  {
+	    ca += au[s];
+	    cat += atu[s];
+	  }
+	int64_t* place = &place_m[uu*n];
+	for(int ll = 0; ll < n; ++ll)
+	  place[ll] += ca * (btpr[ll] - btps[ll]) + cat * (bpr[ll] - bps[ll]);
+      }
+  }
+
 };
 
 // Input/Output functions
@@ -79,23 +510,24 @@ operator>>(std::istream& is, qap_model& qap)
 {
   unsigned int n;
   is >> n;
+  qap_instance* instance = new qap_instance(n);
+  qap.instance_m.reset(instance);
   qap.pi_m.resize(n);
-  qap.a_m.resize(n);
-  qap.b_m.resize(n);
   for(unsigned int ii = 0; ii != n; ++ii)
-    { qap.pi_m[ii] = ii; qap.a_m[ii].resize(n); qap.b_m[ii].resize(n); }
+    qap.pi_m[ii] = ii;
 
   for(unsigned int ii = 0; ii != n; ++ii)
     for(unsigned int jj = 0; jj != n; ++jj)
       {
-	is >> qap.a_m[ii][jj];
+	is >> instance->a()(ii, jj);
       }
 
   for(unsigned int ii = 0; ii != n; ++ii)
     for(unsigned int jj = 0; jj != n; ++jj)
       {
-	is >> qap.b_m[ii][jj];
+	is >> instance->b()(ii, jj);
       }
+  instance->finalize();
   qap.update_cost();
   return is;
 }
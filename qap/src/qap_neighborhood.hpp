@@ -0,0 +1,203 @@
+#pragma once
+
+#include <vector>
+#include <limits>
+#include <stdint.h>
+#include <metslib/mets.hh>
+
+#include "qap_model.hpp"
+
+/// @brief Reads the two positions of a mets::swap_elements (they are
+/// protected members, with no accessor).
+struct qap_swap_access : public mets::swap_elements
+{
+  static int first(const mets::swap_elements& m)
+  { return m.*(&qap_swap_access::p1); }
+  static int second(const mets::swap_elements& m)
+  { return m.*(&qap_swap_access::p2); }
+};
+
+/// @brief The 3-cycle moving facility i to the location of j, j to
+/// the location of k and k to the location of i, on a qap_model.
+///
+/// Its cost variation is computed by qap_model::cycle_delta(), in O(1)
+/// with the delta table and in O(n) without.
+/// qap_robust_tabu_list knows these moves besides swaps.
+class qap_cycle_move : public mets::mana_move
+{
+public:
+  qap_cycle_move(int i, int j, int k)
+    : mets::mana_move(), i_m(i), j_m(j), k_m(k)
+  { }
+
+  mets::gol_type
+  evaluate(const mets::feasible_solution& s) const
+  {
+    const qap_model& model = static_cast<const qap_model&>(s);
+    return model.cost_function() + model.cycle_delta(i_m, j_m, k_m);
+  }
+
+  void
+  apply(mets::feasible_solution& s) const
+  { static_cast<qap_model&>(s).apply_cycle(i_m, j_m, k_m); }
+
+  mets::mana_move*
+  clone() const
+  { return new qap_cycle_move(i_m, j_m, k_m); }
+
+  size_t
+  hash() const
+  { return (i_m << 20) ^ (j_m << 10) ^ k_m; }
+
+  bool
+  operator==(const mets::mana_move& o) const
+  {
+    const qap_cycle_move* m = dynamic_cast<const qap_cycle_move*>(&o);
+    return m && m->i_m == i_m && m->j_m == j_m && m->k_m == k_m;
+  }
+
+  void
+  change(int i, int j, int k)
+  { i_m = i; j_m = j; k_m = k; }
+
+  int first() const { return i_m; }
+  int second() const { return j_m; }
+  int third() const { return k_m; }
+
+protected:
+  int i_m;
+  int j_m;
+  int k_m;
+};
+
+/// @brief Asks a tabu list whether swapping i and j is tabu.
+///
+/// The generic version goes through the mets::tabu_list_chain
+/// interface using a reusable mets::swap_elements probe (no
+/// allocations). Tabu lists with a cheaper test can specialize it.
+template<typename tabu_list_type>
+struct qap_tabu_probe
+{
+  explicit qap_tabu_probe(tabu_list_type& tabu)
+    : tabu_m(tabu), probe_m(0, 1)
+  { }
+
+  bool
+  operator()(mets::feasible_solution& sol, int i, int j)
+  {
+    probe_m.change(i, j);
+    return tabu_m.is_tabu(sol, probe_m);
+  }
+
+  /// @brief The probe move, as last set by operator().
+  mets::swap_elements& move() { return probe_m; }
+
+protected:
+  tabu_list_type& tabu_m;
+  mets::swap_elements probe_m;
+};
+
+/// @brief The best admissible swap found by a scan of (part of) the
+/// swap neighborhood.
+struct qap_swap_choice
+{
+  qap_swap_choice()
+    : delta(std::numeric_limits<int64_t>::max()), i(-1), j(-1)
+  { }
+
+  /// @brief True when this is a better choice than o: a lower delta
+  /// or, for the same delta, a swap coming first in row-major order.
+  bool
+  better_than(const qap_swap_choice& o) const
+  {
+    if(i == -1) return false;
+    if(o.i == -1) return true;
+    if(delta != o.delta) return delta < o.delta;
+    return i < o.i || (i == o.i && j < o.j);
+  }
+
+  int64_t delta;
+  int i;
+  int j;
+};
+
+/// @brief Scans the swaps (i, j), i < j, with i in first_row,
+/// first_row + row_step, ... and records in best the first admissible
+/// swap (in row-major order) with the lowest delta.
+///
+/// The tabu list and the aspiration criteria are only queried for the
+/// candidates that improve on the best swap found so far.
+template<typename probe_type>
+void
+qap_scan_swaps(mets::feasible_solution& s,
+	       probe_type& is_tabu,
+	       mets::aspiration_criteria_chain& aspiration,
+	       int first_row, int row_step,
+	       qap_swap_choice& best)
+{
+  const qap_model& model = static_cast<const qap_model&>(s);
+  const int n = model.size();
+  const mets::gol_type cost = model.cost_function();
+  for(int ii = first_row; ii < n; ii += row_step)
+    for(int jj = ii+1; jj < n; ++jj)
+      {
+	const int64_t delta = model.swap_delta(ii, jj);
+	if(delta >= best.delta)
+	  continue;
+	if(is_tabu(s, ii, jj)
+	   && !aspiration(s, is_tabu.move(), cost + delta))
+	  continue;
+	best.delta = delta;
+	best.i = ii;
+	best.j = jj;
+      }
+}
+
+/// @brief The full swap neighborhood, scanned in a tight loop.
+///
+/// This is a neighborhood for mets::tabu_search with a qap_model
+/// working solution. Instead of presenting one move object per
+/// candidate, refresh() scans all the n(n-1)/2 pairs with non virtual
+/// calls to qap_model::swap_delta() and leaves in the neighborhood
+/// only the best admissible swap: the best non tabu one, or a tabu one
+/// that satisfies the aspiration criteria (see qap_scan_swaps()).
+///
+/// When no swap is admissible the neighborhood is empty and
+/// mets::tabu_search raises mets::no_moves_error, as it would do with
+/// a materialized full neighborhood.
+template<typename tabu_list_type = mets::tabu_list_chain>
+class qap_full_neighborhood
+{
+public:
+  typedef std::vector<mets::move*>::iterator iterator;
+
+  qap_full_neighborhood(tabu_list_type& tabu,
+			mets::aspiration_criteria_chain& aspiration)
+    : is_tabu_m(tabu), aspiration_m(aspiration), best_m(0, 1), moves_m()
+  { moves_m.reserve(1); }
+
+  iterator begin() { return moves_m.begin(); }
+  iterator end() { return moves_m.end(); }
+  size_t size() const { return moves_m.size(); }
+
+  /// @brief Scans the whole neighborhood of s for the best admissible
+  /// swap.
+  void
+  refresh(mets::feasible_solution& s)
+  {
+    qap_swap_choice best;
+    qap_scan_swaps(s, is_tabu_m, aspiration_m, 0, 1, best);
+    moves_m.clear();
+    if(best.i != -1)
+      {
+	best_m.change(best.i, best.j);
+	moves_m.push_back(&best_m);
+      }
+  }
+
+protected:
+  qap_tabu_probe<tabu_list_type> is_tabu_m;
+  mets::aspiration_criteria_chain& aspiration_m;
+  mets::swap_elements best_m;
+  std::vector<mets::move*> moves_m;
+};
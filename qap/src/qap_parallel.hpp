@@ -0,0 +1,367 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <stdexcept>
+#include <stdint.h>
+#include <pthread.h>
+#include <metslib/mets.hh>
+
+#include "qap_model.hpp"
+#include "qap_neighborhood.hpp"
+
+/// @brief Runs each worker (a functor with an operator()()) on its
+/// own thread and waits for all of them.
+///
+/// A single worker is run on the calling thread. If a thread cannot
+/// be started, the workers already running are waited for before a
+/// std::runtime_error is thrown.
+template<typename worker_type>
+void
+qap_run_workers(std::vector<worker_type>& workers)
+{
+  struct trampoline
+  {
+    static void* run(void* w)
+    {
+      (*static_cast<worker_type*>(w))();
+      return 0;
+    }
+  };
+
+  if(workers.size() == 1)
+    {
+      workers[0]();
+      return;
+    }
+  std::vector<pthread_t> threads(workers.size());
+  unsigned int started = 0;
+  while(started != workers.size()
+	&& !pthread_create(&threads[started], 0, &trampoline::run,
+			   &workers[started]))
+    ++started;
+  // the workers started go on with workers: wait for them, even if
+  // the others could not be started
+  for(unsigned int ii = 0; ii != started; ++ii)
+    pthread_join(threads[ii], 0);
+  if(started != workers.size())
+    throw std::runtime_error("Cannot start a worker thread.");
+}
+
+/// @brief The jobs of a pool of threads, dealt to one queue per thread
+/// and balanced by work stealing.
+///
+/// Jobs are indices, dealt round robin. A thread takes the jobs of
+/// its own queue from the front and, once it is empty, steals from
+/// the back of the others (starting from the next thread), so that
+/// the threads left with long jobs are relieved of their last ones.
+/// Each queue has its own mutex: the owner of a queue and a thief
+/// only contend on that one.
+class qap_work_queues
+{
+public:
+  qap_work_queues(unsigned int threads, unsigned int jobs)
+    : queues_m(std::max(1u, threads))
+  {
+    for(unsigned int ii = 0; ii != queues_m.size(); ++ii)
+      queues_m[ii] = new queue;
+    for(unsigned int jj = 0; jj != jobs; ++jj)
+      queues_m[jj % queues_m.size()]->jobs.push_back(jj);
+  }
+
+  ~qap_work_queues()
+  {
+    for(unsigned int ii = 0; ii != queues_m.size(); ++ii)
+      delete queues_m[ii];
+  }
+
+  /// @brief Takes a job for a thread (0 to threads-1), returns false
+  /// once all the queues are empty.
+  bool
+  take(unsigned int thread, unsigned int& job)
+  {
+    const unsigned int threads = queues_m.size();
+    for(unsigned int ii = 0; ii != threads; ++ii)
+      {
+	queue& q = *queues_m[(thread + ii) % threads];
+	pthread_mutex_lock(&q.mutex);
+	const bool found = !q.jobs.empty();
+	if(found && ii == 0)
+	  {
+	    job = q.jobs.front();
+	    q.jobs.pop_front();
+	  }
+	else if(found)
+	  {
+	    job = q.jobs.back();
+	    q.jobs.pop_back();
+	  }
+	pthread_mutex_unlock(&q.mutex);
+	if(found)
+	  return true;
+      }
+    return false;
+  }
+
+private:
+  qap_work_queues(const qap_work_queues&);
+  qap_work_queues& operator=(const qap_work_queues&);
+
+  struct queue
+  {
+    queue() : jobs(), mutex()
+    { pthread_mutex_init(&mutex, 0); }
+
+    ~queue()
+    { pthread_mutex_destroy(&mutex); }
+
+    std::deque<unsigned int> jobs;
+    pthread_mutex_t mutex;
+  };
+
+  std::vector<queue*> queues_m;
+};
+
+/// @brief Records the best solution found by concurrent searches.
+///
+/// The best cost is kept in an integer that is read and lowered with
+/// lock free compare and swap operations, so that a non improving
+/// solution is rejected without taking any lock. The mutex only
+/// serializes the (rare) copies of improving solutions.
+class qap_shared_recorder : public mets::solution_recorder
+{
+public:
+  explicit qap_shared_recorder(qap_model& best)
+    : mets::solution_recorder(), best_m(best),
+      cost_m(int64_t(best.cost_function())), mutex_m()
+  { pthread_mutex_init(&mutex_m, 0); }
+
+  ~qap_shared_recorder()
+  { pthread_mutex_destroy(&mutex_m); }
+
+  /// @brief Accepts the solution if it improves the best cost.
+  bool
+  accept(const mets::feasible_solution& sol)
+  {
+    const qap_model& s = dynamic_cast<const qap_model&>(sol);
+    const int64_t cost = int64_t(s.cost_function());
+    int64_t seen = best_cost();
+    while(cost < seen)
+      {
+	const int64_t prev = __sync_val_compare_and_swap(&cost_m, seen, cost);
+	if(prev == seen)
+	  {
+	    // we own the best cost: publish the solution, unless a
+	    // better one has been copied in the meantime.
+	    pthread_mutex_lock(&mutex_m);
+	    if(s.cost_function() < best_m.cost_function())
+	      best_m.copy_from(s);
+	    pthread_mutex_unlock(&mutex_m);
+	    return true;
+	  }
+	seen = prev;
+      }
+    return false;
+  }
+
+  /// @brief The best cost accepted so far.
+  int64_t
+  best_cost() const
+  { return __sync_fetch_and_add(const_cast<int64_t*>(&cost_m), 0); }
+
+  /// @brief Copies the best solution while the searches are running.
+  void
+  copy_best(qap_model& sol)
+  {
+    pthread_mutex_lock(&mutex_m);
+    sol.copy_from(best_m);
+    pthread_mutex_unlock(&mutex_m);
+  }
+
+  /// @brief The best solution, only to be read once the searches are
+  /// over.
+  const qap_model& best_seen() const
+  { return best_m; }
+
+private:
+  qap_shared_recorder(const qap_shared_recorder&);
+  qap_shared_recorder& operator=(const qap_shared_recorder&);
+
+  qap_model& best_m;
+  int64_t cost_m;
+  pthread_mutex_t mutex_m;
+};
+
+/// @brief The full swap neighborhood, scanned by a pool of threads.
+///
+/// Same as qap_full_neighborhood, but each refresh() splits the rows
+/// of the swap table among the calling thread and threads-1 helper
+/// threads (row i goes to thread i % threads). Every thread records
+/// its best admissible swap, and the results are reduced choosing the
+/// lowest delta and, among equal deltas, the first swap in row-major
+/// order. The chosen swap is therefore the one of the serial scan,
+/// whatever the number of threads.
+///
+/// The helper threads live as long as the neighborhood and wait on a
+/// condition variable between two refreshes. The tabu list and the
+/// aspiration criteria are read concurrently, hence their tests must
+/// not modify them (as it is for the ones provided by metslib).
+template<typename tabu_list_type = mets::tabu_list_chain>
+class qap_parallel_neighborhood
+{
+public:
+  typedef std::vector<mets::move*>::iterator iterator;
+
+  qap_parallel_neighborhood(tabu_list_type& tabu,
+			    mets::aspiration_criteria_chain& aspiration,
+			    unsigned int threads)
+    : aspiration_m(aspiration), best_m(0, 1), moves_m(), slices_m(),
+      mutex_m(), work_m(), done_m(), working_m(0),
+      generation_m(0), pending_m(0), helpers_m(0), stop_m(false)
+  {
+    moves_m.reserve(1);
+    pthread_mutex_init(&mutex_m, 0);
+    pthread_cond_init(&work_m, 0);
+    pthread_cond_init(&done_m, 0);
+    for(unsigned int ii = 0; ii != std::max(1u, threads); ++ii)
+      slices_m.push_back(new slice(this, ii, tabu));
+    for(unsigned int ii = 1; ii < slices_m.size(); ++ii, ++helpers_m)
+      if(pthread_create(&slices_m[ii]->thread, 0, &slice::run, slices_m[ii]))
+	{
+	  shutdown();
+	  throw std::runtime_error("Cannot start a worker thread.");
+	}
+  }
+
+  ~qap_parallel_neighborhood()
+  { shutdown(); }
+
+  iterator begin() { return moves_m.begin(); }
+  iterator end() { return moves_m.end(); }
+  size_t size() const { return moves_m.size(); }
+
+  /// @brief Scans the whole neighborhood of s for the best admissible
+  /// swap.
+  void
+  refresh(mets::feasible_solution& s)
+  {
+    pthread_mutex_lock(&mutex_m);
+    working_m = &s;
+    pending_m = helpers_m;
+    ++generation_m;
+    pthread_cond_broadcast(&work_m);
+    pthread_mutex_unlock(&mutex_m);
+
+    slices_m[0]->scan(s);
+
+    pthread_mutex_lock(&mutex_m);
+    while(pending_m)
+      pthread_cond_wait(&done_m, &mutex_m);
+    pthread_mutex_unlock(&mutex_m);
+
+    qap_swap_choice best;
+    for(unsigned int ii = 0; ii != slices_m.size(); ++ii)
+      if(slices_m[ii]->best.better_than(best))
+	best = slices_m[ii]->best;
+    moves_m.clear();
+    if(best.i != -1)
+      {
+	best_m.change(best.i, best.j);
+	moves_m.push_back(&best_m);
+      }
+  }
+
+protected:
+  /// @brief The rows scanned by one thread, and their result.
+  struct slice
+  {
+    slice(qap_parallel_neighborhood* o, unsigned int i, tabu_list_type& t)
+      : owner(o), index(i), is_tabu(t), best(), thread()
+    { }
+
+    void
+    scan(mets::feasible_solution& s)
+    {
+      best = qap_swap_choice();
+      qap_scan_swaps(s, is_tabu, owner->aspiration_m,
+		     index, owner->slices_m.size(), best);
+    }
+
+    static void*
+    run(void* arg)
+    {
+      static_cast<slice*>(arg)->owner->serve(*static_cast<slice*>(arg));
+      return 0;
+    }
+
+    qap_parallel_neighborhood* owner;
+    unsigned int index;
+    qap_tabu_probe<tabu_list_type> is_tabu;
+    qap_swap_choice best;
+    pthread_t thread;
+
+  private:
+    slice(const slice&);
+    slice& operator=(const slice&);
+  };
+
+  // Body of the helper threads: one scan per generation.
+  void
+  serve(slice& sl)
+  {
+    unsigned long seen = 0;
+    pthread_mutex_lock(&mutex_m);
+    for(;;)
+      {
+	while(generation_m == seen && !stop_m)
+	  pthread_cond_wait(&work_m, &mutex_m);
+	if(stop_m)
+	  break;
+	seen = generation_m;
+	mets::feasible_solution& s = *working_m;
+	pthread_mutex_unlock(&mutex_m);
+	sl.scan(s);
+	pthread_mutex_lock(&mutex_m);
+	if(--pending_m == 0)
+	  pthread_cond_signal(&done_m);
+      }
+    pthread_mutex_unlock(&mutex_m);
+  }
+
+  // Stops and joins the helper threads, frees the slices.
+  void
+  shutdown()
+  {
+    pthread_mutex_lock(&mutex_m);
+    stop_m = true;
+    pthread_cond_broadcast(&work_m);
+    pthread_mutex_unlock(&mutex_m);
+    for(unsigned int ii = 1; ii <= helpers_m; ++ii)
+      pthread_join(slices_m[ii]->thread, 0);
+    for(unsigned int ii = 0; ii != slices_m.size(); ++ii)
+      delete slices_m[ii];
+    slices_m.clear();
+    helpers_m = 0;
+    pthread_cond_destroy(&done_m);
+    pthread_cond_destroy(&work_m);
+    pthread_mutex_destroy(&mutex_m);
+  }
+
+private:
+  qap_parallel_neighborhood(const qap_parallel_neighborhood&);
+  qap_parallel_neighborhood& operator=(const qap_parallel_neighborhood&);
+
+  mets::aspiration_criteria_chain& aspiration_m;
+  mets::swap_elements best_m;
+  std::vector<mets::move*> moves_m;
+  std::vector<slice*> slices_m;
+  pthread_mutex_t mutex_m;
+  pthread_cond_t work_m;
+  pthread_cond_t done_m;
+  mets::feasible_solution* working_m;
+  unsigned long generation_m;
+  unsigned int pending_m;
+  unsigned int helpers_m;
+  bool stop_m;
+};
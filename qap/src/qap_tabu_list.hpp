@@ -0,0 +1,229 @@
+#pragma once
+
+#include <cassert>
+#include <vector>
+#include <algorithm>
+#include <typeinfo>
+#include <tr1/random>
+#include <metslib/mets.hh>
+
+#include "qap_model.hpp"
+#include "qap_neighborhood.hpp"
+
+/// @brief The attribute based tabu memory of Taillard's robust tabu
+/// search (Ro-TS) for the QAP.
+///
+/// Instead of copies of the recent moves, an n x n table records for
+/// each facility i and location p the iteration until which i may not
+/// go back to p. When facilities i and j are swapped, i is kept away
+/// from the location it left (and so is j) for tenure iterations, and
+/// a later swap of i and j is tabu when it would bring both of them
+/// back to a forbidden location. Both operations are O(1) and
+/// allocation free.
+///
+/// With randomize() the tenure is drawn again every 2 * tmax
+/// iterations, uniformly in [tmin, tmax] around the tenure of the
+/// list, as in Ro-TS.
+///
+/// It is a mets::tabu_list_chain for a qap_model working solution
+/// and mets::swap_elements moves. As in mets::tabu_search, tabu() is
+/// called before the move is applied: the locations the facilities
+/// leave are the ones they hold in sol.
+///
+/// It also records qap_cycle_move 3-cycles: each of the three
+/// facilities is kept away from the location it left, and a 3-cycle
+/// is tabu when it would bring all three back to forbidden locations.
+class qap_robust_tabu_list : public mets::tabu_list_chain
+{
+public:
+  qap_robust_tabu_list(unsigned int n, unsigned int tenure)
+    : mets::tabu_list_chain(tenure), n_m(n), until_m(n*n, 0),
+      iteration_m(0), current_m(tenure), next_draw_m(0), rng_m(0),
+      spread_m(0.0)
+  { }
+
+  qap_robust_tabu_list(mets::tabu_list_chain* next,
+		       unsigned int n, unsigned int tenure)
+    : mets::tabu_list_chain(next, tenure), n_m(n), until_m(n*n, 0),
+      iteration_m(0), current_m(tenure), next_draw_m(0), rng_m(0),
+      spread_m(0.0)
+  { }
+
+  /// @brief Draws the tenure in [tenure * (1 - spread), tenure * (1 +
+  /// spread)], changing it every 2 * tmax iterations.
+  void
+  randomize(std::tr1::mt19937& rng, double spread = 0.1)
+  {
+    rng_m = &rng;
+    spread_m = spread;
+    next_draw_m = iteration_m;
+  }
+
+  /// @brief Sets the number of facilities (the table is reused if it
+  /// is large enough) and forgets all the tabu attributes.
+  void
+  resize(unsigned int n)
+  {
+    n_m = n;
+    until_m.assign(n*n, 0);
+    iteration_m = 0;
+    next_draw_m = 0;
+  }
+
+  /// @brief Forgets all the tabu attributes.
+  void
+  clear()
+  {
+    std::fill(until_m.begin(), until_m.end(), 0);
+    iteration_m = 0;
+    next_draw_m = 0;
+  }
+
+  void
+  tabu(mets::feasible_solution& sol, mets::move& mov)
+  {
+    const qap_model& model = static_cast<const qap_model&>(sol);
+    ++iteration_m;
+    if(!rng_m)
+      current_m = tenure();
+    else if(iteration_m >= next_draw_m)
+      draw_tenure();
+    const unsigned int until = iteration_m + current_m;
+    if(typeid(mov) == typeid(qap_cycle_move))
+      {
+	const qap_cycle_move& cycle = static_cast<const qap_cycle_move&>(mov);
+	const int i = cycle.first();
+	const int j = cycle.second();
+	const int k = cycle.third();
+	// i is leaving its location for the one of j, j for the one of
+	// k and k for the one of i
+	until_m[i*n_m + model.location(i)] = until;
+	until_m[j*n_m + model.location(j)] = until;
+	until_m[k*n_m + model.location(k)] = until;
+      }
+    else
+      {
+	const mets::swap_elements& swap =
+	  static_cast<const mets::swap_elements&>(mov);
+	const int i = qap_swap_access::first(swap);
+	const int j = qap_swap_access::second(swap);
+	// the move is about to be made: i and j leave their locations
+	until_m[i*n_m + model.location(i)] = until;
+	until_m[j*n_m + model.location(j)] = until;
+      }
+    if(next_m)
+      next_m->tabu(sol, mov);
+  }
+
+  bool
+  is_tabu(mets::feasible_solution& sol, mets::move& mov) const
+  {
+    const qap_model& model = static_cast<const qap_model&>(sol);
+    if(typeid(mov) == typeid(qap_cycle_move))
+      {
+	const qap_cycle_move& cycle = static_cast<const qap_cycle_move&>(mov);
+	if(is_tabu(model, cycle.first(), cycle.second(), cycle.third()))
+	  return true;
+      }
+    else
+      {
+	const mets::swap_elements& swap =
+	  static_cast<const mets::swap_elements&>(mov);
+	if(is_tabu(model, qap_swap_access::first(swap),
+		   qap_swap_access::second(swap)))
+	  return true;
+      }
+    return next_m && next_m->is_tabu(sol, mov);
+  }
+
+  /// @brief True if swapping facilities i and j would bring both of
+  /// them back to a location they are kept away from.
+  bool
+  is_tabu(const qap_model& model, int i, int j) const
+  {
+    return until_m[i*n_m + model.location(j)] > iteration_m
+      && until_m[j*n_m + model.location(i)] > iteration_m;
+  }
+
+  /// @brief True if the 3-cycle of facilities i, j and k (see
+  /// qap_cycle_move) would bring all three back to a location they
+  /// are kept away from.
+  bool
+  is_tabu(const qap_model& model, int i, int j, int k) const
+  {
+    return until_m[i*n_m + model.location(j)] > iteration_m
+      && until_m[j*n_m + model.location(k)] > iteration_m
+      && until_m[k*n_m + model.location(i)] > iteration_m;
+  }
+
+  /// @brief The table of the tabu attributes, for checkpoints.
+  const std::vector<unsigned int>& table() const
+  { return until_m; }
+
+  /// @brief The moves recorded since the last clear().
+  unsigned int iteration() const
+  { return iteration_m; }
+
+  /// @brief Restores a table and an iteration count saved with
+  /// table() and iteration().
+  void
+  restore(const std::vector<unsigned int>& table, unsigned int iteration)
+  {
+    assert(table.size() == until_m.size());
+    until_m = table;
+    iteration_m = iteration;
+    next_draw_m = iteration;
+  }
+
+  /// @brief The tenure of the last recorded move.
+  unsigned int current_tenure() const
+  { return current_m; }
+
+private:
+  qap_robust_tabu_list(const qap_robust_tabu_list&);
+  qap_robust_tabu_list& operator=(const qap_robust_tabu_list&);
+
+protected:
+  void
+  draw_tenure()
+  {
+    const double t = tenure();
+    const int tmin = std::max(1, int(t * (1.0 - spread_m)));
+    const int tmax = std::max(tmin, int(t * (1.0 + spread_m)));
+    std::tr1::uniform_int<int> range(tmin, tmax);
+    current_m = range(*rng_m);
+    next_draw_m = iteration_m + 2 * tmax;
+  }
+
+  unsigned int n_m;
+  std::vector<unsigned int> until_m;
+  unsigned int iteration_m;
+  unsigned int current_m;
+  unsigned int next_draw_m;
+  std::tr1::mt19937* rng_m;
+  double spread_m;
+};
+
+/// @brief The tabu test of qap_robust_tabu_list, without going
+/// through the virtual interface.
+template<>
+struct qap_tabu_probe<qap_robust_tabu_list>
+{
+  explicit qap_tabu_probe(qap_robust_tabu_list& tabu)
+    : tabu_m(tabu), probe_m(0, 1)
+  { }
+
+  bool
+  operator()(mets::feasible_solution& sol, int i, int j)
+  {
+    probe_m.change(i, j);
+    return tabu_m.qap_robust_tabu_list::is_tabu(sol, probe_m);
+  }
+
+  /// @brief The probe move, as last set by operator().
+  mets::swap_elements& move() { return probe_m; }
+
+protected:
+  qap_robust_tabu_list& tabu_m;
+  mets::swap_elements probe_m;
+};
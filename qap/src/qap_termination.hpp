@@ -0,0 +1,133 @@
+#pragma once
+
+#include <time.h>
+#include <metslib/mets.hh>
+
+/// @brief Stops the search once a wall clock deadline has passed.
+///
+/// The deadline is set at construction, seconds from then (no
+/// deadline if seconds <= 0), and it is not moved by reset(): it
+/// bounds the whole run, across the restarts of the searches it is
+/// chained to. The clock is read once per iteration of the search,
+/// from the coarse monotonic clock (a few nanoseconds, no system
+/// call), never while the neighborhood is scanned.
+class qap_deadline_termination_criteria
+  : public mets::termination_criteria_chain
+{
+public:
+  qap_deadline_termination_criteria(mets::termination_criteria_chain* next,
+				    double seconds)
+    : mets::termination_criteria_chain(next), enabled_m(seconds > 0),
+      deadline_m(now() + seconds)
+  { }
+
+  bool
+  operator()(const mets::feasible_solution& fs)
+  {
+    if(passed())
+      return true;
+    return mets::termination_criteria_chain::operator()(fs);
+  }
+
+  /// @brief True once the deadline has passed.
+  bool passed() const
+  { return enabled_m && now() >= deadline_m; }
+
+  /// @brief Seconds on the coarse monotonic clock.
+  static double
+  now()
+  {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+  }
+
+protected:
+  bool enabled_m;
+  double deadline_m;
+};
+
+/// @brief Stops the search once a number of move evaluations has
+/// been made.
+///
+/// Each check is one iteration of the search, charged as the
+/// evaluations of one scan of its neighborhood (no budget if
+/// evaluations is 0). As for the deadline, reset() does not refill
+/// the budget. The count is atomic, so that the searches of several
+/// threads can share one budget.
+class qap_evaluations_termination_criteria
+  : public mets::termination_criteria_chain
+{
+public:
+  qap_evaluations_termination_criteria(mets::termination_criteria_chain* next,
+				       unsigned long evaluations,
+				       unsigned long per_iteration)
+    : mets::termination_criteria_chain(next), budget_m(evaluations),
+      per_iteration_m(per_iteration), used_m(0)
+  { }
+
+  bool
+  operator()(const mets::feasible_solution& fs)
+  {
+    if(budget_m
+       && __sync_fetch_and_add(&used_m, per_iteration_m) >= budget_m)
+      return true;
+    return mets::termination_criteria_chain::operator()(fs);
+  }
+
+  /// @brief The evaluations charged so far.
+  unsigned long used() const
+  { return used_m; }
+
+protected:
+  unsigned long budget_m;
+  unsigned long per_iteration_m;
+  unsigned long used_m;
+};
+
+/// @brief Remembers that the criteria chained to it asked to stop.
+///
+/// Once they have, it keeps answering true without asking them again
+/// (also after a reset()), so that the caller of a search can tell a
+/// search that was stopped from one that ended by itself.
+///
+/// The deadline of the run, if given (it may also be in the chain),
+/// can be polled between two searches, e.g. while a solution is
+/// perturbed: the chain is not asked, and no evaluation is charged.
+class qap_stop_latch : public mets::termination_criteria_chain
+{
+public:
+  explicit qap_stop_latch(mets::termination_criteria_chain* next = 0,
+			  const qap_deadline_termination_criteria* deadline = 0)
+    : mets::termination_criteria_chain(next), deadline_m(deadline),
+      stopped_m(false)
+  { }
+
+  bool
+  operator()(const mets::feasible_solution& fs)
+  {
+    if(!stopped_m)
+      stopped_m = mets::termination_criteria_chain::operator()(fs);
+    return stopped_m;
+  }
+
+  bool stopped() const
+  { return stopped_m; }
+
+  /// @brief Stops once the deadline has passed, returns stopped().
+  bool
+  poll()
+  {
+    if(!stopped_m && deadline_m && deadline_m->passed())
+      stopped_m = true;
+    return stopped_m;
+  }
+
+private:
+  qap_stop_latch(const qap_stop_latch&);
+  qap_stop_latch& operator=(const qap_stop_latch&);
+
+protected:
+  const qap_deadline_termination_criteria* deadline_m;
+  bool stopped_m;
+};
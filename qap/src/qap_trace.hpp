@@ -0,0 +1,331 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <metslib/mets.hh>
+
+#include "qap_neighborhood.hpp"
+
+/// @brief The header of a binary search trace.
+///
+/// It is followed by the records of all the threads: the records of a
+/// thread are in order, those of different threads are interleaved
+/// in chunks (sort them by time to merge them).
+struct qap_trace_header
+{
+  enum { byte_order_mark = 0x01020304, format_version = 1 };
+
+  char magic[8];		// "QAPTRACE"
+  uint32_t byte_order;		// byte_order_mark, as written
+  uint32_t version;		// format_version
+  uint32_t record_size;		// sizeof(qap_trace_record)
+  uint32_t threads;
+  uint64_t records;		// records written
+  uint64_t dropped;		// records lost to full rings
+  char padding[24];
+};
+
+/// @brief A move of a search, as recorded in a trace.
+struct qap_trace_record
+{
+  enum { move_made = 0, improvement_made = 1 };
+
+  uint64_t iteration;		// moves made by the thread, this one included
+  int64_t cost;			// cost after the move
+  uint64_t nanoseconds;		// since the trace was opened
+  uint16_t i;			// the swapped facilities
+  uint16_t j;
+  uint16_t thread;
+  uint16_t kind;		// move_made or improvement_made
+};
+
+class qap_trace;
+
+/// @brief The single producer, single consumer ring of the records of
+/// one search thread.
+///
+/// The search thread appends records without locks or system calls;
+/// the writer thread of the trace drains the ring to the file. It is
+/// woken up early when the ring gets half full, otherwise it drains
+/// the rings periodically. If the writer falls behind and the ring
+/// fills up, records are dropped (and counted) rather than slowing
+/// down the search.
+class qap_trace_ring
+{
+public:
+  qap_trace_ring(qap_trace* owner, unsigned int thread, unsigned int size)
+    : owner_m(owner), records_m(size), mask_m(size - 1), head_m(0),
+      tail_m(0), dropped_m(0), thread_m(thread), iteration_m(0)
+  { }
+
+  /// @brief Appends a record of the given kind, time stamped now.
+  inline void
+  push(int64_t cost, int i, int j, unsigned int kind);
+
+  /// @brief Moves made by this thread so far, for the iteration
+  /// numbers of the records.
+  uint64_t& iteration() { return iteration_m; }
+
+private:
+  qap_trace_ring(const qap_trace_ring&);
+  qap_trace_ring& operator=(const qap_trace_ring&);
+
+protected:
+  friend class qap_trace;
+
+  qap_trace* owner_m;
+  std::vector<qap_trace_record> records_m;
+  unsigned long mask_m;
+  volatile unsigned long head_m;	// written by the search thread
+  volatile unsigned long tail_m;	// written by the writer thread
+  unsigned long dropped_m;
+  unsigned int thread_m;
+  uint64_t iteration_m;
+};
+
+/// @brief A binary trace file, with one ring per search thread and a
+/// writer thread flushing them asynchronously.
+class qap_trace
+{
+public:
+  /// @brief Creates the trace file, with the rings of threads search
+  /// threads (of ring_size records, rounded up to a power of two).
+  qap_trace(const std::string& filename, unsigned int threads,
+	    unsigned int ring_size = 1 << 16)
+    : out_m(0), rings_m(), start_m(clock()), records_m(0),
+      mutex_m(), wake_m(), writer_m(), stop_m(false)
+  {
+    out_m = std::fopen(filename.c_str(), "wb");
+    if(!out_m)
+      throw std::runtime_error("Cannot create " + filename);
+    write_header();
+    unsigned int size = 2;
+    while(size < ring_size)
+      size *= 2;
+    for(unsigned int ii = 0; ii != threads; ++ii)
+      rings_m.push_back(new qap_trace_ring(this, ii, size));
+    pthread_mutex_init(&mutex_m, 0);
+    pthread_cond_init(&wake_m, 0);
+    if(pthread_create(&writer_m, 0, &qap_trace::run, this))
+      {
+	pthread_cond_destroy(&wake_m);
+	pthread_mutex_destroy(&mutex_m);
+	close_file();
+	throw std::runtime_error("Cannot start the trace writer thread.");
+      }
+  }
+
+  /// @brief Flushes all the records and closes the file.
+  ~qap_trace()
+  {
+    pthread_mutex_lock(&mutex_m);
+    stop_m = true;
+    pthread_cond_signal(&wake_m);
+    pthread_mutex_unlock(&mutex_m);
+    pthread_join(writer_m, 0);
+    drain();
+    pthread_cond_destroy(&wake_m);
+    pthread_mutex_destroy(&mutex_m);
+    close_file();
+  }
+
+  /// @brief The ring of a search thread (0 to threads-1).
+  qap_trace_ring& ring(unsigned int thread)
+  { return *rings_m[thread]; }
+
+  /// @brief Nanoseconds since the trace was opened.
+  uint64_t
+  now() const
+  { return clock() - start_m; }
+
+  /// @brief Wakes up the writer thread.
+  void
+  wake()
+  {
+    pthread_mutex_lock(&mutex_m);
+    pthread_cond_signal(&wake_m);
+    pthread_mutex_unlock(&mutex_m);
+  }
+
+private:
+  qap_trace(const qap_trace&);
+  qap_trace& operator=(const qap_trace&);
+
+  static uint64_t
+  clock()
+  {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+  }
+
+  static void*
+  run(void* arg)
+  {
+    static_cast<qap_trace*>(arg)->serve();
+    return 0;
+  }
+
+  // Body of the writer thread: drains the rings every 100 ms, or as
+  // soon as one is half full.
+  void
+  serve()
+  {
+    pthread_mutex_lock(&mutex_m);
+    while(!stop_m)
+      {
+	timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += 100000000;
+	if(deadline.tv_nsec >= 1000000000)
+	  {
+	    deadline.tv_sec += 1;
+	    deadline.tv_nsec -= 1000000000;
+	  }
+	pthread_cond_timedwait(&wake_m, &mutex_m, &deadline);
+	pthread_mutex_unlock(&mutex_m);
+	drain();
+	pthread_mutex_lock(&mutex_m);
+      }
+    pthread_mutex_unlock(&mutex_m);
+  }
+
+  // Writes the records pushed so far to the file.
+  void
+  drain()
+  {
+    for(unsigned int ii = 0; ii != rings_m.size(); ++ii)
+      {
+	qap_trace_ring& r = *rings_m[ii];
+	const unsigned long head = r.head_m;
+	__sync_synchronize();
+	for(unsigned long tail = r.tail_m; tail != head; )
+	  {
+	    const unsigned long first = tail & r.mask_m;
+	    const unsigned long count =
+	      std::min(head - tail, r.records_m.size() - first);
+	    std::fwrite(&r.records_m[first], sizeof(qap_trace_record),
+			count, out_m);
+	    records_m += count;
+	    tail += count;
+	  }
+	__sync_synchronize();
+	r.tail_m = head;
+      }
+  }
+
+  void
+  write_header()
+  {
+    qap_trace_header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "QAPTRACE", 8);
+    header.byte_order = qap_trace_header::byte_order_mark;
+    header.version = qap_trace_header::format_version;
+    header.record_size = sizeof(qap_trace_record);
+    header.threads = rings_m.size();
+    header.records = records_m;
+    for(unsigned int ii = 0; ii != rings_m.size(); ++ii)
+      header.dropped += rings_m[ii]->dropped_m;
+    std::fseek(out_m, 0, SEEK_SET);
+    std::fwrite(&header, sizeof(header), 1, out_m);
+    std::fseek(out_m, 0, SEEK_END);
+  }
+
+  // Writes the final header (counts), closes the file.
+  void
+  close_file()
+  {
+    write_header();
+    std::fclose(out_m);
+    for(unsigned int ii = 0; ii != rings_m.size(); ++ii)
+      delete rings_m[ii];
+    rings_m.clear();
+  }
+
+  FILE* out_m;
+  std::vector<qap_trace_ring*> rings_m;
+  uint64_t start_m;
+  uint64_t records_m;
+  pthread_mutex_t mutex_m;
+  pthread_cond_t wake_m;
+  pthread_t writer_m;
+  bool stop_m;
+};
+
+void
+qap_trace_ring::push(int64_t cost, int i, int j, unsigned int kind)
+{
+  const unsigned long head = head_m;
+  const unsigned long used = head - tail_m;
+  if(used == records_m.size())
+    {
+      ++dropped_m;
+      return;
+    }
+  qap_trace_record& r = records_m[head & mask_m];
+  r.iteration = iteration_m;
+  r.cost = cost;
+  r.nanoseconds = owner_m->now();
+  r.i = i;
+  r.j = j;
+  r.thread = thread_m;
+  r.kind = kind;
+  __sync_synchronize();
+  head_m = head + 1;
+  if(used + 1 == records_m.size() / 2)
+    owner_m->wake();
+}
+
+/// @brief A search listener writing the moves of a search to a ring
+/// of a qap_trace.
+///
+/// Every k-th move is recorded (every move with k = 1), or, if
+/// improvements is set, only the moves improving the solution
+/// recorded by the search.
+template<typename neighborhood_t>
+class qap_trace_listener : public mets::search_listener<neighborhood_t>
+{
+public:
+  qap_trace_listener(qap_trace_ring& ring, unsigned int every = 1,
+		     bool improvements = false)
+    : mets::search_listener<neighborhood_t>(), ring_m(ring),
+      every_m(std::max(1u, every)), improvements_m(improvements)
+  { }
+
+  void
+  update(mets::abstract_search<neighborhood_t>* as)
+  {
+    typedef mets::abstract_search<neighborhood_t> search_t;
+    unsigned int kind;
+    if(as->step() == search_t::MOVE_MADE)
+      {
+	const uint64_t iteration = ring_m.iteration()++;
+	if(improvements_m || iteration % every_m)
+	  return;
+	kind = qap_trace_record::move_made;
+      }
+    else if(as->step() == search_t::IMPROVEMENT_MADE && improvements_m)
+      kind = qap_trace_record::improvement_made;
+    else
+      return;
+    const mets::swap_elements& swap =
+      static_cast<const mets::swap_elements&>(as->current_move());
+    ring_m.push(int64_t(static_cast<const mets::evaluable_solution&>
+			(as->working()).cost_function()),
+		qap_swap_access::first(swap), qap_swap_access::second(swap),
+		kind);
+  }
+
+protected:
+  qap_trace_ring& ring_m;
+  unsigned int every_m;
+  bool improvements_m;
+};
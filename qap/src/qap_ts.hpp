@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cmath>
+
+/// @brief The robust tabu search of tsqap, as set up by tsqap and by
+/// qapbench, which must measure the same search.
+struct qap_ts_settings
+{
+  /// @brief Non improving moves after which the search stops.
+  enum { max_noimprove = 1000 };
+
+  /// @brief The tenure of the Ro-TS tabu list for n facilities,
+  /// randomized by 10% around it: Taillard's [0.9 n, 1.1 n].
+  static unsigned int tenure(unsigned int n)
+  { return n; }
+
+  /// @brief The swaps sampled at each move by the default
+  /// neighborhood, n * sqrt(n).
+  static unsigned int sampled_swaps(unsigned int n)
+  { return (unsigned int)(std::sqrt(double(n)) * n); }
+};
@@ -0,0 +1,781 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <new>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <tr1/random>
+
+#include "qap_instance.hpp"
+#include "qap_kernels.hpp"
+#include "qap_model.hpp"
+#include "qap_io.hpp"
+#include "qap_neighborhood.hpp"
+#include "qap_tabu_list.hpp"
+#include "qap_termination.hpp"
+#include "qap_its.hpp"
+#include "qap_islands.hpp"
+#include "qap_ts.hpp"
+
+using namespace std;
+
+void usage()
+{
+  cerr << "qapbench kernels" << endl
+       << "qapbench load (qaplib.dat | n)" << endl
+       << "qapbench allocs qaplib.dat" << endl
+       << "qapbench suite (csv | json) datadir [seconds [seed]]" << endl;
+  ::exit(1);
+}
+
+// Heap allocations made so far, counted by the replaced operator new.
+//
+// The replacements take their memory from malloc() and give it back
+// with free(), all of them: they are kept out of line, so that the
+// compiler does not see a free() of memory from operator new where a
+// delete expression is inlined (-Wmismatched-new-delete).
+unsigned long allocations = 0;
+
+// Dynamic exception specifications are deprecated by C++11 and gone
+// from C++17: the replacements use the ones of the standard in use.
+#if __cplusplus >= 201103L
+#define QAPBENCH_THROWS_BAD_ALLOC
+#define QAPBENCH_NOTHROW noexcept
+#else
+#define QAPBENCH_THROWS_BAD_ALLOC throw(std::bad_alloc)
+#define QAPBENCH_NOTHROW throw()
+#endif
+
+__attribute__((noinline))
+void* operator new(std::size_t size) QAPBENCH_THROWS_BAD_ALLOC
+{
+  __sync_fetch_and_add(&allocations, 1);
+  void* p = std::malloc(size ? size : 1);
+  if(!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+__attribute__((noinline))
+void* operator new[](std::size_t size) QAPBENCH_THROWS_BAD_ALLOC
+{ return operator new(size); }
+
+__attribute__((noinline))
+void operator delete(void* p) QAPBENCH_NOTHROW
+{ std::free(p); }
+
+__attribute__((noinline))
+void operator delete[](void* p) QAPBENCH_NOTHROW
+{ std::free(p); }
+
+#if __cplusplus >= 201402L
+// the sized deletes of C++14 give the memory back the same way
+__attribute__((noinline))
+void operator delete(void* p, std::size_t) QAPBENCH_NOTHROW
+{ std::free(p); }
+
+__attribute__((noinline))
+void operator delete[](void* p, std::size_t) QAPBENCH_NOTHROW
+{ std::free(p); }
+#endif
+
+// Monotonic wall clock in seconds.
+double now()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Random matrices with entries in [0, 100), symmetric if asked,
+// stored both as int (in wide) and as int16_t (in narrow), and a
+// random permutation.
+void random_instance(qap_instance& wide, qap_instance& narrow,
+		     vector<int>& p, std::tr1::mt19937& rng,
+		     bool symmetric = false)
+{
+  std::tr1::uniform_int<int> value(0, 99);
+  for(unsigned int ii = 0; ii != wide.size(); ++ii)
+    for(unsigned int jj = symmetric ? ii : 0; jj != wide.size(); ++jj)
+      {
+	narrow.a()(ii, jj) = wide.a()(ii, jj) = value(rng);
+	narrow.b()(ii, jj) = wide.b()(ii, jj) = value(rng);
+	if(symmetric)
+	  {
+	    narrow.a()(jj, ii) = wide.a()(jj, ii) = wide.a()(ii, jj);
+	    narrow.b()(jj, ii) = wide.b()(jj, ii) = wide.b()(ii, jj);
+	  }
+      }
+  wide.finalize(false);
+  narrow.finalize();
+  p.resize(wide.size());
+  for(unsigned int ii = 0; ii != wide.size(); ++ii)
+    p[ii] = ii;
+  std::tr1::uniform_int<int> unigen;
+  std::tr1::variate_generator<std::tr1::mt19937&, std::tr1::uniform_int<int> >
+    gen(rng, unigen);
+  std::random_shuffle(p.begin(), p.end(), gen);
+}
+
+// The kernel sets available on this CPU for matrices of T.
+template<typename T>
+vector<qap_kernels<T> > kernel_sets()
+{
+  vector<qap_kernels<T> > sets;
+  sets.push_back(qap_kernels<T>::scalar());
+  qap_kernels<T> best = qap_kernels<T>::select(0);
+  if(best.swap != qap_kernels<T>::scalar().swap)
+    {
+      qap_kernels<T> avx2 = qap_kernels<T>::select("avx2");
+      sets.push_back(avx2);
+      if(best.swap != avx2.swap)
+	sets.push_back(best);
+    }
+  return sets;
+}
+
+// Times the swap kernel on the given (i, j) pairs, returns ns per call
+// and the sum of the results (as a checksum).
+template<typename T>
+double time_swap(typename qap_kernels<T>::swap_kernel kernel,
+		 const qap_data<T>& q,
+		 const vector<int>& p, const vector<int>& pairs,
+		 int64_t& checksum)
+{
+  const unsigned int n = q.a.size();
+  checksum = 0;
+  double start = now();
+  for(unsigned int kk = 0; kk < pairs.size(); kk += 2)
+    {
+      const int i = pairs[kk];
+      const int j = pairs[kk+1];
+      checksum += kernel(q.a.row(i), q.a.row(j),
+			 q.at.row(i), q.at.row(j),
+			 q.b.row(p[i]), q.b.row(p[j]),
+			 q.bt.row(p[i]), q.bt.row(p[j]),
+			 &p[0], n);
+    }
+  return (now() - start) * 1e9 / (pairs.size() / 2);
+}
+
+// Same as time_swap(), for the symmetric swap kernel on matrices
+// that are both symmetric: returns twice the sums, as the general
+// kernel would.
+template<typename T>
+double time_symmetric_swap(typename qap_kernels<T>::symmetric_swap_kernel
+			   kernel, const qap_data<T>& q,
+			   const vector<int>& p, const vector<int>& pairs,
+			   int64_t& checksum)
+{
+  const unsigned int n = q.a.size();
+  checksum = 0;
+  double start = now();
+  for(unsigned int kk = 0; kk < pairs.size(); kk += 2)
+    {
+      const int i = pairs[kk];
+      const int j = pairs[kk+1];
+      checksum += 2 * kernel(q.a.row(i), q.a.row(j),
+			     q.b.row(p[i]), q.b.row(p[j]), &p[0], n);
+    }
+  return (now() - start) * 1e9 / (pairs.size() / 2);
+}
+
+// Times the kernel sets on q, prints the times and updates the fastest
+// one; results are checked against reference (set by the first call).
+template<typename T>
+int time_sets(const vector<qap_kernels<T> >& sets, const qap_data<T>& q,
+	      const vector<int>& p, const vector<int>& pairs,
+	      bool first, int64_t& reference, double& base, double& fastest)
+{
+  int errors = 0;
+  for(unsigned int kk = 0; kk != sets.size(); ++kk)
+    {
+      int64_t checksum;
+      double ns = time_swap<T>(sets[kk].swap, q, p, pairs, checksum);
+      if(first && kk == 0) { base = fastest = ns; reference = checksum; }
+      else if(checksum != reference) ++errors;
+      fastest = std::min(fastest, ns);
+      cout << setw(first ? 12 : 13) << fixed << setprecision(1) << ns;
+    }
+  return errors;
+}
+
+// Random (i, j) pairs, i != j, about 2^24 multiply-adds worth of swap
+// kernels for size n.
+vector<int> random_pairs(unsigned int n, std::tr1::mt19937& rng)
+{
+  vector<int> pairs;
+  std::tr1::uniform_int<int> index(0, n-1);
+  for(unsigned int kk = 0; kk < (1u<<24) / n; ++kk)
+    {
+      int i = index(rng);
+      int j = index(rng);
+      while(i == j) j = index(rng);
+      pairs.push_back(i);
+      pairs.push_back(j);
+    }
+  return pairs;
+}
+
+// Compares the general and the symmetric swap kernels of the selected
+// set, on symmetric int and int16_t matrices.
+int bench_symmetric_kernels(const unsigned int* sizes, unsigned int count)
+{
+  std::tr1::mt19937 rng(4321);
+  const qap_kernels<int>& wide_set = qap_kernels<int>::get();
+  const qap_kernels<int16_t>& narrow_set = qap_kernels<int16_t>::get();
+  cout << endl << "symmetric matrices, " << wide_set.name << " kernels"
+       << endl << setw(5) << "n" << setw(12) << "general ns"
+       << setw(14) << "symmetric ns" << setw(15) << "general/16 ns"
+       << setw(17) << "symmetric/16 ns" << setw(10) << "speedup" << endl;
+  int errors = 0;
+  for(unsigned int ss = 0; ss != count; ++ss)
+    {
+      const unsigned int n = sizes[ss];
+      qap_instance wide(n), narrow(n);
+      vector<int> p;
+      random_instance(wide, narrow, p, rng, true);
+      const vector<int> pairs = random_pairs(n, rng);
+      int64_t reference, checksum;
+      const double general = time_swap<int>(wide_set.swap, wide.data<int>(),
+					    p, pairs, reference);
+      double fastest = general;
+      cout << setw(5) << n << setw(12) << fixed << setprecision(1) << general;
+      double ns = time_symmetric_swap<int>(wide_set.symmetric_swap,
+					   wide.data<int>(), p, pairs,
+					   checksum);
+      errors += checksum != reference;
+      fastest = std::min(fastest, ns);
+      cout << setw(14) << ns;
+      ns = time_swap<int16_t>(narrow_set.swap, narrow.data<int16_t>(),
+			      p, pairs, checksum);
+      errors += checksum != reference;
+      fastest = std::min(fastest, ns);
+      cout << setw(15) << ns;
+      ns = time_symmetric_swap<int16_t>(narrow_set.symmetric_swap,
+					narrow.data<int16_t>(), p, pairs,
+					checksum);
+      errors += checksum != reference;
+      fastest = std::min(fastest, ns);
+      cout << setw(17) << ns
+	   << setw(9) << setprecision(2) << general / fastest << "x" << endl;
+    }
+  return errors;
+}
+
+// Compares the available swap kernels, on int and on int16_t
+// matrices, for n = 12 to 1024, then the symmetric ones.
+int bench_kernels()
+{
+  std::tr1::mt19937 rng(1234);
+  const vector<qap_kernels<int> > wide_sets = kernel_sets<int>();
+  const vector<qap_kernels<int16_t> > narrow_sets = kernel_sets<int16_t>();
+
+  const unsigned int sizes[] = { 12, 16, 20, 25, 32, 50, 64,
+				 100, 128, 150, 200, 256, 512, 1024 };
+  cout << setw(5) << "n";
+  for(unsigned int kk = 0; kk != wide_sets.size(); ++kk)
+    cout << setw(12) << (string(wide_sets[kk].name) + " ns");
+  for(unsigned int kk = 0; kk != narrow_sets.size(); ++kk)
+    cout << setw(13) << (string(narrow_sets[kk].name) + "/16 ns");
+  cout << setw(10) << "speedup" << endl;
+
+  int errors = 0;
+  for(unsigned int ss = 0; ss != sizeof(sizes)/sizeof(*sizes); ++ss)
+    {
+      const unsigned int n = sizes[ss];
+      qap_instance wide(n), narrow(n);
+      vector<int> p;
+      random_instance(wide, narrow, p, rng);
+      const vector<int> pairs = random_pairs(n, rng);
+      cout << setw(5) << n;
+      double base = 0.0, fastest = 0.0;
+      int64_t reference = 0;
+      errors += time_sets(wide_sets, wide.data<int>(), p, pairs,
+			  true, reference, base, fastest);
+      errors += time_sets(narrow_sets, narrow.data<int16_t>(), p, pairs,
+			  false, reference, base, fastest);
+      cout << setw(9) << setprecision(2) << base / fastest << "x" << endl;
+    }
+  errors += bench_symmetric_kernels(sizes, sizeof(sizes)/sizeof(*sizes));
+  if(errors)
+    cerr << errors << " kernel results differ from the scalar ones" << endl;
+  return errors ? 1 : 0;
+}
+
+// Writes a random n x n instance in the QAPLIB format.
+void write_instance(const string& filename, unsigned int n)
+{
+  std::tr1::mt19937 rng(1234);
+  std::tr1::uniform_int<int> value(0, 99);
+  ofstream out(filename.c_str());
+  out << n << "\n";
+  for(int mm = 0; mm != 2; ++mm)
+    {
+      out << "\n";
+      for(unsigned int ii = 0; ii != n; ++ii)
+	{
+	  for(unsigned int jj = 0; jj != n; ++jj)
+	    out << " " << value(rng);
+	  out << "\n";
+	}
+    }
+}
+
+// True when the two instances hold the same matrices.
+bool same_instance(const qap_instance& x, const qap_instance& y)
+{
+  if(x.size() != y.size())
+    return false;
+  for(unsigned int ii = 0; ii != x.size(); ++ii)
+    for(unsigned int jj = 0; jj != x.size(); ++jj)
+      if(x.flow(ii, jj) != y.flow(ii, jj)
+	 || x.distance(ii, jj) != y.distance(ii, jj))
+	return false;
+  return true;
+}
+
+// Compares the load time of the stream extraction, of the mapped
+// loader and of the binary cache (removed afterwards, unless it was
+// already there). The argument is either a QAPLIB file or the size of
+// a random instance to be generated (in a temporary file).
+int bench_load(const string& what)
+{
+  string filename(what);
+  bool generated = false;
+  if(what.find_first_not_of("0123456789") == string::npos)
+    {
+      char name[] = "/tmp/qapbenchXXXXXX";
+      int fd = ::mkstemp(name);
+      if(fd == -1) { cerr << "Cannot create a temporary file" << endl; return 1; }
+      ::close(fd);
+      filename = name;
+      generated = true;
+      write_instance(filename, atoi(what.c_str()));
+    }
+
+  // warm the page cache, so that both paths read from memory
+  { ifstream in(filename.c_str()); stringstream ss; ss << in.rdbuf(); }
+
+  const string cachename = filename + ".cache";
+  const bool had_cache = ::access(cachename.c_str(), F_OK) == 0;
+  const int repeat = 5;
+  double stream_time = 1e30, mapped_time = 1e30, cached_time = 1e30;
+  qap_model streamed;
+  qap_instance_ptr mapped, cached;
+  int result = 0;
+  try
+    {
+      // creates the cache, if needed
+      qap_load_cached(filename);
+      for(int rr = 0; rr != repeat; ++rr)
+	{
+	  double start = now();
+	  mapped = qap_load_dat(filename);
+	  mapped_time = std::min(mapped_time, now() - start);
+
+	  start = now();
+	  cached = qap_load_cached(filename);
+	  cached_time = std::min(cached_time, now() - start);
+
+	  start = now();
+	  ifstream in(filename.c_str());
+	  in >> streamed;
+	  stream_time = std::min(stream_time, now() - start);
+	}
+      cout << "n = " << mapped->size()
+	   << (mapped->narrow() ? ", int16_t" : ", int") << " elements" << endl
+	   << setw(10) << "stream" << setw(12) << fixed << setprecision(2)
+	   << stream_time * 1e3 << " ms" << endl
+	   << setw(10) << "mapped" << setw(12)
+	   << mapped_time * 1e3 << " ms" << setw(10)
+	   << stream_time / mapped_time << "x" << endl
+	   << setw(10) << "cached" << setw(12)
+	   << cached_time * 1e3 << " ms" << setw(10)
+	   << stream_time / cached_time << "x" << endl;
+      if(!same_instance(*streamed.instance(), *mapped)
+	 || !same_instance(*streamed.instance(), *cached))
+	{
+	  cerr << "The loaders read different matrices" << endl;
+	  result = 1;
+	}
+    }
+  catch(std::exception& e)
+    {
+      cerr << e.what() << endl;
+      result = 1;
+    }
+  if(!had_cache)
+    ::unlink(cachename.c_str());
+  if(generated)
+    ::unlink(filename.c_str());
+  return result;
+}
+
+// Counts the moves of the searches it is attached to and the heap
+// allocations made since the first one.
+template<typename neighborhood_t>
+struct allocation_counter : public mets::search_listener<neighborhood_t>
+{
+  allocation_counter()
+    : mets::search_listener<neighborhood_t>(), moves(0), first(0)
+  { }
+
+  void
+  update(mets::abstract_search<neighborhood_t>* as)
+  {
+    if(as->step() == mets::abstract_search<neighborhood_t>::MOVE_MADE
+       && moves++ == 0)
+      first = allocations;
+  }
+
+  unsigned long moves;
+  unsigned long first;
+};
+
+// Runs a start of the iterated tabu search of itsqap on the given
+// neighborhood, prints and returns the heap allocations made once the
+// search is running (the set up of the start is not counted).
+template<typename neighborhood_t, typename tabu_list_type>
+unsigned long
+count_allocations(const char* name, qap_model& problem_instance,
+		  neighborhood_t& neighborhood,
+		  tabu_list_type& tabu_list,
+		  mets::best_ever_criteria& aspiration_criteria,
+		  std::tr1::mt19937& rng)
+{
+  const int N = problem_instance.size();
+  std::tr1::uniform_int<int> tlg(7, N*7);
+  std::tr1::uniform_int<int> psg(7, std::max(7, N/2));
+  qap_model majorit_solution(problem_instance);
+  qap_model minorit_solution(problem_instance);
+  mets::best_ever_solution majorit_recorder(majorit_solution);
+  allocation_counter<neighborhood_t> counter;
+  ostream null(0);
+  const unsigned int minor_iterations =
+    qap_minor_iterations(problem_instance, majorit_recorder, minorit_solution,
+			 neighborhood, tabu_list, aspiration_criteria, &counter,
+			 null, rng, tlg, psg);
+  const unsigned long made = allocations - counter.first;
+  cout << setw(16) << name << setw(8) << minor_iterations
+       << setw(10) << counter.moves << setw(12) << made
+       << setw(14) << fixed << setprecision(2)
+       << double(made) / minor_iterations
+       << setw(10) << double(made) / counter.moves << endl;
+  return made;
+}
+
+// Runs count_allocations() with a fresh tabu list and neighborhood.
+template<typename tabu_list_type>
+unsigned long
+count_allocations(const char* name, const qap_instance_ptr& instance,
+		  tabu_list_type& tabu_list, bool full)
+{
+  const int N = instance->size();
+  std::tr1::mt19937 rng(1);
+  qap_model problem_instance(instance);
+  mets::random_shuffle(problem_instance, rng);
+  mets::best_ever_criteria aspiration_criteria;
+  if(full)
+    {
+      qap_full_neighborhood<tabu_list_type>
+	neighborhood(tabu_list, aspiration_criteria);
+      return count_allocations(name, problem_instance, neighborhood,
+			       tabu_list, aspiration_criteria, rng);
+    }
+  mets::swap_neighborhood<std::tr1::mt19937> neighborhood(rng, N*12);
+  return count_allocations(name, problem_instance, neighborhood,
+			   tabu_list, aspiration_criteria, rng);
+}
+
+// Counts the heap allocations of the minor iterations of itsqap,
+// for the sampled and the full swap neighborhoods, with the tabu list
+// of metslib (a copy of each tabu move) and with the attribute based
+// one of itsqap. Fails if the latter makes any once the search is
+// running: the minor iterations of itsqap are allocation free.
+int bench_allocs(const string& filename)
+{
+  qap_instance_ptr instance;
+  try
+    {
+      instance = qap_load_dat(filename);
+    }
+  catch(std::exception& e)
+    {
+      cerr << e.what() << endl;
+      return 1;
+    }
+  const int N = instance->size();
+  cout << "n = " << N << endl
+       << setw(16) << "" << setw(8) << "minor" << setw(10) << "moves"
+       << setw(12) << "allocs" << setw(14) << "allocs/minor"
+       << setw(10) << "/move" << endl;
+  unsigned long robust = 0;
+  for(int full = 0; full != 2; ++full)
+    {
+      mets::simple_tabu_list simple(7);
+      count_allocations(full ? "full/simple" : "sampled/simple",
+			instance, simple, full);
+      qap_robust_tabu_list tabu_list(N, 7);
+      robust += count_allocations(full ? "full/robust" : "sampled/robust",
+				  instance, tabu_list, full);
+    }
+  if(robust)
+    {
+      cerr << "The minor iterations with the Ro-TS tabu list made "
+	   << robust << " heap allocations." << endl;
+      return 1;
+    }
+  return 0;
+}
+
+// The outcome of a run of the suite.
+struct suite_run
+{
+  suite_run()
+    : iterations(0), neighbors(0), best(0), seconds(0), to_target(-1)
+  { }
+
+  unsigned long iterations;	// moves made
+  unsigned long neighbors;	// swaps evaluated per move
+  mets::gol_type best;
+  double seconds;
+  double to_target;		// -1 if the target was not reached
+};
+
+// Counts the moves of a run and records when the target was reached.
+template<typename neighborhood_t>
+struct suite_listener : public mets::search_listener<neighborhood_t>
+{
+  suite_listener(suite_run& r, mets::gol_type t, double s)
+    : mets::search_listener<neighborhood_t>(), run(r), target(t), start(s)
+  { }
+
+  void
+  update(mets::abstract_search<neighborhood_t>* as)
+  {
+    if(as->step() != mets::abstract_search<neighborhood_t>::MOVE_MADE)
+      return;
+    ++run.iterations;
+    const mets::gol_type cost =
+      static_cast<const mets::evaluable_solution&>(as->working())
+      .cost_function();
+    if(run.to_target < 0 && cost <= target)
+      run.to_target = now() - start;
+  }
+
+  suite_run& run;
+  mets::gol_type target;
+  double start;
+};
+
+// The tabu search of tsqap (sampled neighborhood, Ro-TS tabu list,
+// see qap_ts_settings), stopped as tsqap stops or at the deadline.
+suite_run run_ts(const qap_instance_ptr& instance, mets::gol_type target,
+		 double seconds, unsigned long seed)
+{
+  typedef mets::swap_neighborhood<std::tr1::mt19937> neighborhood_t;
+  suite_run run;
+  const double start = now();
+  std::tr1::mt19937 rng(seed);
+  qap_model problem_instance(instance);
+  const unsigned int N = problem_instance.size();
+  qap_model incumbent_solution(problem_instance);
+  mets::best_ever_solution incumbent_recorder(incumbent_solution);
+  mets::random_shuffle(problem_instance, rng);
+  qap_robust_tabu_list tabu_list(N, qap_ts_settings::tenure(N));
+  tabu_list.randomize(rng);
+  mets::best_ever_criteria aspiration_criteria;
+  qap_deadline_termination_criteria deadline(0, seconds);
+  mets::noimprove_termination_criteria
+    termination_criteria(qap_ts_settings::max_noimprove, &deadline);
+  neighborhood_t neighborhood(rng, qap_ts_settings::sampled_swaps(N));
+  run.neighbors = neighborhood.size();
+  mets::tabu_search<neighborhood_t> algorithm(problem_instance,
+					      incumbent_recorder,
+					      neighborhood,
+					      tabu_list,
+					      aspiration_criteria,
+					      termination_criteria);
+  suite_listener<neighborhood_t> listener(run, target, start);
+  algorithm.attach(listener);
+  try
+    {
+      algorithm.search();
+    }
+  catch(mets::no_moves_error&)
+    { }
+  run.best = incumbent_solution.cost_function();
+  run.seconds = now() - start;
+  return run;
+}
+
+// The iterated tabu search of itsqap (one thread, sampled
+// neighborhood, see qap_its_settings), its starts set up by
+// qap_its_start() as itsqap sets them up, stopped when all the starts
+// are done or at the deadline.
+suite_run run_its(const qap_instance_ptr& instance, mets::gol_type target,
+		  double seconds, unsigned long seed)
+{
+  typedef mets::swap_neighborhood<std::tr1::mt19937> neighborhood_t;
+  suite_run run;
+  const double start = now();
+  std::tr1::mt19937 rng;
+  const qap_model initial(instance);
+  qap_model problem_instance(initial);
+  const unsigned int N = problem_instance.size();
+  const qap_island_ranges ranges(N, 0, 1);
+  std::tr1::uniform_int<int> tlg(ranges.tenure_min, ranges.tenure_max);
+  std::tr1::uniform_int<int> psg(ranges.swaps_min, ranges.swaps_max);
+  neighborhood_t neighborhood(rng, qap_its_settings::sampled_swaps(N));
+  run.neighbors = neighborhood.size();
+  qap_model incumbent_solution(problem_instance);
+  qap_model majorit_solution(problem_instance);
+  qap_model minorit_solution(problem_instance);
+  qap_robust_tabu_list tabu_list(N, 7);
+  mets::best_ever_criteria aspiration_criteria;
+  qap_deadline_termination_criteria deadline(0, seconds);
+  qap_stop_latch stop(&deadline, &deadline);
+  suite_listener<neighborhood_t> listener(run, target, start);
+  ostream null(0);
+  const unsigned int starts = qap_its_settings::starts(N);
+  for(unsigned int ss = 0; ss != starts && !stop.poll(); ++ss)
+    {
+      tabu_list.clear();
+      aspiration_criteria.reset();
+      qap_its_start(problem_instance, initial, majorit_solution, tabu_list,
+		    rng, seed + ss, tlg);
+      mets::best_ever_solution majorit_recorder(majorit_solution);
+      qap_minor_iterations(problem_instance, majorit_recorder,
+			   minorit_solution, neighborhood, tabu_list,
+			   aspiration_criteria, &listener, null,
+			   rng, tlg, psg, &stop);
+      if(ss == 0 || majorit_solution.cost_function()
+	 < incumbent_solution.cost_function())
+	incumbent_solution.copy_from(majorit_solution);
+    }
+  run.best = incumbent_solution.cost_function();
+  run.seconds = now() - start;
+  return run;
+}
+
+// Runs tsqap and itsqap on each instance of datadir having a best
+// known solution (name.dat and name.sln), with a fixed seed and a
+// time budget per run, and writes, one record per run, the gap to
+// the best known solution, the moves made (iterations) and the swaps
+// evaluated per second and the time needed to reach the best known
+// solution.
+int bench_suite(const string& format, const string& datadir,
+		double seconds, unsigned long seed)
+{
+  if(format != "csv" && format != "json")
+    usage();
+  vector<string> names;
+  DIR* dir = ::opendir(datadir.c_str());
+  if(!dir)
+    {
+      cerr << "Cannot open " << datadir << endl;
+      return 1;
+    }
+  while(dirent* entry = ::readdir(dir))
+    {
+      const string name(entry->d_name);
+      if(name.size() > 4 && name.compare(name.size() - 4, 4, ".sln") == 0
+	 && ::access((datadir + "/" + name.substr(0, name.size() - 4)
+		      + ".dat").c_str(), R_OK) == 0)
+	names.push_back(name.substr(0, name.size() - 4));
+    }
+  ::closedir(dir);
+  std::sort(names.begin(), names.end());
+
+  const bool json = format == "json";
+  if(json)
+    cout << "[";
+  else
+    cout << "instance,n,solver,seed,budget,best,bks,gap,seconds,"
+	 << "iterations,iterations_per_second,moves_per_second,"
+	 << "time_to_target" << endl;
+  bool first = true;
+  for(unsigned int ii = 0; ii != names.size(); ++ii)
+    {
+      const string path = datadir + "/" + names[ii];
+      qap_instance_ptr instance;
+      unsigned int n;
+      mets::gol_type bks;
+      try
+	{
+	  instance = qap_load_dat(path + ".dat");
+	}
+      catch(std::exception& e)
+	{
+	  cerr << e.what() << endl;
+	  return 1;
+	}
+      ifstream sln((path + ".sln").c_str());
+      if(!(sln >> n >> bks) || n != instance->size())
+	{
+	  cerr << "Bad solution file " << path << ".sln" << endl;
+	  return 1;
+	}
+      for(int solver = 0; solver != 2; ++solver)
+	{
+	  const suite_run run = solver
+	    ? run_its(instance, bks, seconds, seed)
+	    : run_ts(instance, bks, seconds, seed);
+	  const double gap = bks ? 100.0 * (run.best - bks) / bks : 0.0;
+	  // a run may end within the resolution of the clock
+	  const double ips = run.seconds > 0
+	    ? run.iterations / run.seconds : 0.0;
+	  ostringstream ttt;
+	  if(run.to_target >= 0)
+	    ttt << run.to_target;
+	  else if(json)
+	    ttt << "null";
+	  if(json)
+	    cout << (first ? "\n" : ",\n")
+		 << "{\"instance\": \"" << names[ii] << "\", \"n\": " << n
+		 << ", \"solver\": \"" << (solver ? "itsqap" : "tsqap")
+		 << "\", \"seed\": " << seed << ", \"budget\": " << seconds
+		 << ", \"best\": " << int64_t(run.best)
+		 << ", \"bks\": " << int64_t(bks)
+		 << ", \"gap\": " << gap << ", \"seconds\": " << run.seconds
+		 << ", \"iterations\": " << run.iterations
+		 << ", \"iterations_per_second\": " << ips
+		 << ", \"moves_per_second\": " << ips * run.neighbors
+		 << ", \"time_to_target\": " << ttt.str() << "}";
+	  else
+	    cout << names[ii] << "," << n << ","
+		 << (solver ? "itsqap" : "tsqap") << "," << seed << ","
+		 << seconds << "," << int64_t(run.best) << ","
+		 << int64_t(bks) << "," << gap << "," << run.seconds << ","
+		 << run.iterations << "," << ips << ","
+		 << ips * run.neighbors << "," << ttt.str() << endl;
+	  first = false;
+	}
+    }
+  if(json)
+    cout << "\n]" << endl;
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  if(argc < 2) usage();
+  string what(argv[1]);
+  if(what == "kernels" && argc == 2)
+    return bench_kernels();
+  if(what == "load" && argc == 3)
+    return bench_load(argv[2]);
+  if(what == "allocs" && argc == 3)
+    return bench_allocs(argv[2]);
+  if(what == "suite" && argc >= 4 && argc <= 6)
+    return bench_suite(argv[2], argv[3], argc > 4 ? atof(argv[4]) : 10.0,
+		       argc > 5 ? strtoul(argv[5], 0, 10) : 1);
+  usage();
+}
@@ -0,0 +1,84 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "qap_io.hpp"
+#include "qap_trace.hpp"
+
+using namespace std;
+
+void usage()
+{
+  cerr << "qaptrace [options] trace" << endl
+       << "  -s, --sort                merge the threads, sorting the moves"
+       << endl
+       << "                            by time" << endl;
+  ::exit(1);
+}
+
+// Orders the records by time, then by thread.
+bool earlier(const qap_trace_record& x, const qap_trace_record& y)
+{
+  if(x.nanoseconds != y.nanoseconds)
+    return x.nanoseconds < y.nanoseconds;
+  return x.thread < y.thread;
+}
+
+// Decodes a binary trace written by tsqap or itsqap (--trace) as
+// text, one move per line: thread, iteration, seconds, cost, the
+// swapped facilities (1 based) and "m" for a move or "i" for an
+// improvement.
+int main(int argc, char* argv[])
+{
+  bool sort = false;
+  int arg = 1;
+  for(; arg < argc && argv[arg][0] == '-'; ++arg)
+    if(!strcmp(argv[arg], "-s") || !strcmp(argv[arg], "--sort"))
+      sort = true;
+    else
+      usage();
+  if(arg != argc-1) usage();
+
+  try
+    {
+      qap_mapped_file file(argv[arg]);
+      qap_trace_header header;
+      if(file.size() < sizeof(header))
+	throw std::runtime_error(string("Not a trace: ") + argv[arg]);
+      std::memcpy(&header, file.begin(), sizeof(header));
+      if(std::memcmp(header.magic, "QAPTRACE", 8)
+	 || header.byte_order != qap_trace_header::byte_order_mark
+	 || header.version != qap_trace_header::format_version
+	 || header.record_size != sizeof(qap_trace_record))
+	throw std::runtime_error(string("Not a trace: ") + argv[arg]);
+      const size_t count =
+	(file.size() - sizeof(header)) / sizeof(qap_trace_record);
+      vector<qap_trace_record> records(count);
+      if(count)
+	std::memcpy(&records[0], file.begin() + sizeof(header),
+		    count * sizeof(qap_trace_record));
+      if(sort)
+	std::stable_sort(records.begin(), records.end(), earlier);
+      for(size_t ii = 0; ii != count; ++ii)
+	{
+	  const qap_trace_record& r = records[ii];
+	  cout << r.thread << " " << r.iteration << " "
+	       << fixed << setprecision(6) << r.nanoseconds * 1e-9 << " "
+	       << r.cost << " " << r.i + 1 << " " << r.j + 1 << " "
+	       << (r.kind == qap_trace_record::improvement_made ? "i" : "m")
+	       << "\n";
+	}
+      if(header.dropped)
+	cerr << header.dropped << " moves were dropped" << endl;
+    }
+  catch(std::exception& e)
+    {
+      cerr << e.what() << endl;
+      return 1;
+    }
+  return 0;
+}